@@ -2,30 +2,54 @@
 
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <CL/cl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace ecl{
     const std::size_t MAX_PLATFORMS_COUNT = 64;
     const std::size_t MAX_DEVICES_COUNT = 64;
     const std::size_t MAX_INFO_SIZE = 1024;
+    const std::size_t HOST_ALIGNMENT = 4096; // page, what drivers want to share host memory
 
     enum ACCESS{READ = CL_MEM_READ_ONLY, WRITE = CL_MEM_WRITE_ONLY, READ_WRITE = CL_MEM_READ_WRITE};
     enum DEVICE{CPU = CL_DEVICE_TYPE_CPU, GPU = CL_DEVICE_TYPE_GPU, ACCEL = CL_DEVICE_TYPE_ACCELERATOR};
     enum FREE{AUTO, MANUALLY};
     enum EXEC {SYNC, ASYNC};
+    enum LOCAL{FIT, PAD, TUNE};
+    enum MEMORY{COPY, ZERO_COPY};
+
+    typedef std::pair<std::size_t, std::size_t> Range; // offset and size in bytes
 
 ///////////////////////////////////////////////////////////////////////////////
 // Error Class Declaration
 ///////////////////////////////////////////////////////////////////////////////
+    // Thread safety: the last OpenCL status is kept per thread, Program, Kernel and Buffer
+    // caches are locked, and every launch borrows its own kernel instance, so several
+    // threads may drive the same Computer. A single container or Plan is not meant to be
+    // modified from several threads at once.
     class Error{
     protected:
-        static int error;
+        static thread_local int error; // per thread, so concurrent calls don't clobber each other
         static std::string getErrorString();
 
     public:
@@ -83,16 +107,38 @@ namespace ecl{
 ///////////////////////////////////////////////////////////////////////////////
     class Program : public Error{
     private:
-        std::map<cl_context, cl_program> program;
+        static std::string cache; // binaries cache directory, empty if disabled
+
+        std::map<std::pair<cl_context, std::string>, cl_program> program; // programs map by context and build options
+        std::map<std::pair<cl_context, std::string>, cl_program> object; // compiled, not linked objects
+        std::vector<Program*> modules; // linked modules, not owned
         std::string source;
+        std::string options; // build options of the current variant
+        mutable std::mutex lock; // guards program and object maps, builds run unlocked
+
+        std::string getBuildError(cl_program, cl_device_id);
+        static std::string getLinkOptions(const std::string&);
+
+        cl_program buildSource(cl_context, cl_device_id, const std::string&);
+        cl_program buildLinked(cl_context, cl_device_id, const std::string&);
+        std::string getSignature() const;
+        void collect(std::vector<Program*>&);
 
-        std::string getBuildError(cl_context, cl_device_id);
+        static std::uint64_t hash(const std::string&);
+        static std::string getDeviceString(cl_device_id, cl_device_info);
+        static std::vector<cl_device_id> getContextDevices(cl_context);
+
+        std::string getCacheKey(cl_device_id, const std::string&) const;
+        std::string getCacheFile(const std::string&) const;
+        cl_program loadBinary(cl_context, const std::string&) const;
+        void saveBinary(cl_program, const std::string&) const;
 
 		void copy(const Program&);
 		void move(Program&);
     public:
         Program(const char*);
         Program(const std::string&);
+        Program(const std::string&, const std::string&);
 
         Program(const Program&);
         Program& operator=(const Program&);
@@ -102,8 +148,15 @@ namespace ecl{
 
         static Program load(const std::string&);
 
+        static void setCache(const std::string&);
+        static const std::string& getCache();
+
         cl_program getProgram(cl_context) const;
+        cl_program getProgram(cl_context, const std::string&) const;
         const std::string& getSource() const;
+        const std::string& getOptions() const;
+        const std::vector<Program*>& getModules() const;
+        std::uint64_t getHash() const;
 
         Program& operator=(const std::string&);
         Program& operator=(const char*);
@@ -118,8 +171,13 @@ namespace ecl{
         friend std::ostream& operator<<(std::ostream&, const Program&);
 
         void setSource(const std::string&);
+        void setOptions(const std::string&);
+
+        Program& link(Program&);
 
         bool checkProgram(cl_context, cl_device_id);
+        bool checkProgram(cl_context, cl_device_id, const std::string&);
+        cl_program checkObject(cl_context, cl_device_id, const std::string&);
 
         void clear();
         ~Program();
@@ -129,12 +187,45 @@ namespace ecl{
 // Kernel Class Declaration
 ///////////////////////////////////////////////////////////////////////////////
     class Kernel: public Error{
+    public:
+        struct Info{
+            std::size_t work_group_size = 0; // largest work-group the kernel can run with on the device
+            std::size_t preferred_multiple = 1; // work-group size multiple preferred by the device
+            std::size_t compile_work_group_size[3] = {0, 0, 0}; // reqd_work_group_size, zeros if not set
+            cl_ulong local_memory = 0; // local memory used by the kernel
+            cl_ulong private_memory = 0; // private memory used by each work-item
+        };
+
+        class Instance{ // kernel object borrowed by one launch, since clSetKernelArg isn't thread safe
+        private:
+            Kernel* owner = nullptr;
+            cl_program program = nullptr;
+            cl_kernel kernel = nullptr;
+        public:
+            Instance(Kernel&, cl_program);
+
+            Instance(const Instance&) = delete;
+            Instance& operator=(const Instance&) = delete;
+
+            Instance(Instance&&);
+            Instance& operator=(Instance&&) = delete;
+
+            operator cl_kernel() const;
+            ~Instance();
+        };
     private:
         std::map<cl_program, cl_kernel> kernel; // карта ядер по программам
+        std::map<cl_program, std::vector<cl_kernel>> idle; // instances not borrowed by a launch
+        std::vector<cl_kernel> extra; // instances created for concurrent launches
+        std::map<std::pair<cl_program, cl_device_id>, Info> info; // resources by program and device
         std::string name;
+        mutable std::mutex lock; // guards kernel, instance and info maps
 
 		void copy(const Kernel&);
 		void move(Kernel&);
+
+        cl_kernel borrow(cl_program);
+        void restore(cl_program, cl_kernel);
     public:
         Kernel(const char*);
         Kernel(const std::string&);
@@ -161,21 +252,193 @@ namespace ecl{
         const std::string& getName() const;
 
         cl_kernel getKernel(cl_program) const;
+        Info getInfo(cl_program, cl_device_id);
         bool checkKernel(cl_program);
 
         void clear();
         ~Kernel();
     };
 
+///////////////////////////////////////////////////////////////////////////////
+// Pool Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Pool : public Error{ // per context device memory, carved from slabs by sub-buffers
+    public:
+        struct Stats{
+            std::size_t reserved = 0; // bytes of all slabs
+            std::size_t direct = 0; // bytes of buffers allocated on their own: too large for a slab, or zero-copy
+            std::size_t idle = 0; // bytes of slabs without live blocks
+            std::size_t used = 0; // bytes handed out
+            std::size_t slabs = 0;
+            std::size_t blocks = 0;
+            std::size_t hits = 0; // allocations served without the driver
+            std::size_t misses = 0;
+            std::size_t trimmed = 0; // slabs given back to the driver
+        };
+    private:
+        struct Slab{
+            cl_mem mem;
+            std::size_t size;
+            std::vector<std::size_t> free; // offsets of free blocks
+            std::size_t used;
+        };
+        struct Block{
+            Slab* slab;
+            std::size_t offset;
+            std::size_t size;
+            std::vector<cl_event> busy; // commands of tracked lanes, the block isn't handed out again before they completed
+        };
+        struct Retired{
+            cl_context context;
+            Block block;
+            std::atomic<std::size_t> count; // commands left
+        };
+        struct Heap{
+            std::size_t align = 0; // strictest sub-buffer origin alignment of the context devices
+            std::map<std::size_t, std::vector<std::unique_ptr<Slab>>> classes; // slabs by block size
+            std::map<cl_mem, Block> blocks;
+            std::map<cl_mem, std::size_t> direct;
+            std::map<cl_mem, cl_mem> views; // sub-buffers of other buffers, each holds a reference to its parent
+            std::map<cl_mem, std::size_t> refs; // references taken by retain
+            Stats stats;
+        };
+
+        static std::map<cl_context, Heap> heaps;
+        static std::mutex lock;
+        static std::size_t slab_size;
+        static std::size_t high;
+        static std::size_t low;
+
+        static std::size_t getAlign(cl_context);
+        static Slab* getSlab(cl_context, Heap&, std::size_t);
+        static void trim(Heap&, std::size_t);
+        static void settle(std::vector<cl_event>&);
+        static void recycle(Heap&, const Block&);
+        static void drop(Heap&, cl_mem, std::vector<Block>&);
+        static void CL_CALLBACK retire(cl_event, cl_int, void*);
+    public:
+        static cl_mem create(cl_context, ACCESS, std::size_t, cl_mem_flags host = 0, void* ptr = nullptr);
+        static cl_mem slice(cl_context, cl_mem, ACCESS, std::size_t, std::size_t);
+        static void retain(cl_context, cl_mem);
+        static void use(cl_context, cl_mem, cl_event);
+        static void release(cl_context, cl_mem);
+        static cl_mem getOwner(cl_context, cl_mem);
+        static bool isShared(cl_context, cl_mem);
+        static void trim(cl_context);
+
+        static void setSlabSize(std::size_t);
+        static void setWatermarks(std::size_t, std::size_t);
+        static Stats getStats(cl_context);
+    };
+
+///////////////////////////////////////////////////////////////////////////////
+// Memory Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Buffer;
+
+    class Memory : public Error{ // device memory of the buffers per context, least recently used ones go back to host memory when it runs out
+    public:
+        struct Stats{
+            std::size_t live = 0; // bytes of buffers on the device, as the containers count them
+            std::size_t buffers = 0;
+            std::size_t peak = 0; // high-water mark of live bytes
+            std::size_t reserved = 0; // device bytes the pool holds: whole slabs and buffers allocated on their own
+            std::size_t allocations = 0; // device copies created
+            std::size_t evictions = 0;
+            std::size_t evicted = 0; // bytes
+        };
+        struct Usage{
+            const Buffer* buffer;
+            std::size_t size;
+            ACCESS access;
+        };
+    private:
+        struct Entry{
+            Buffer* buffer;
+            cl_mem mem;
+            std::size_t size;
+            cl_event last; // last command using it
+            std::size_t pins; // bound by a launch in progress
+            bool written; // device data the host lacks, without coherence to bring it back
+        };
+        struct Resident{
+            std::list<Entry> order; // least recently used first
+            std::map<const Buffer*, std::list<Entry>::iterator> entries;
+            std::size_t budget = 0; // 0 leaves it to the driver
+            std::size_t limit = 0; // allocations past it fail, 0 for none
+            std::size_t pending = 0; // bytes being allocated, held against the limit until they're added
+            Stats stats;
+        };
+
+        static std::map<cl_context, Resident> residents;
+        static Stats total;
+        static std::mutex lock;
+
+        static void count(Resident&, std::size_t, bool);
+
+        static bool evict(cl_context, const Buffer*);
+        static void reset(Entry&);
+    public:
+        static cl_mem create(cl_context, const Buffer*, ACCESS, std::size_t, cl_mem_flags host = 0, void* ptr = nullptr);
+        static void cancel(cl_context, std::size_t);
+        static void add(cl_context, Buffer*, cl_mem);
+        static void drop(cl_context, const Buffer*);
+        static void rename(cl_context, const Buffer*, Buffer*);
+
+        static void use(cl_context, const Buffer*, cl_event);
+        static void setWritten(cl_context, const Buffer*, bool);
+        static void pin(cl_context, const Buffer*);
+        static void unpin(cl_context, const Buffer*);
+
+        static void setBudget(cl_context, std::size_t);
+        static std::size_t getBudget(cl_context);
+        static std::size_t getResident(cl_context);
+        static void setLimit(cl_context, std::size_t);
+        static std::size_t getLimit(cl_context);
+
+        static Stats getStats(cl_context);
+        static Stats getTotal();
+        static std::vector<Usage> getLargest(cl_context, std::size_t);
+        static void resetPeak(cl_context);
+        static void forget(cl_context);
+    };
+
 ///////////////////////////////////////////////////////////////////////////////
 // Buffer Class Declaration
 ///////////////////////////////////////////////////////////////////////////////
     class Buffer : public Error{
     protected:
         std::map<cl_context, cl_mem> buffer; // buffers map by context
+        mutable std::mutex lock; // guards buffer map
         void* ptr = nullptr; // pointer to data
         std::size_t size = 0; // sizeof data
         ACCESS access = READ; // memory access
+        MEMORY memory = COPY;
+        std::map<cl_context, void*> mapped; // zero-copy buffers currently owned by the host
+
+        bool tracking = false;
+        std::map<cl_context, std::vector<Range>> dirty; // host writes since the last upload, only for complete device copies
+
+        bool coherent = false;
+        std::set<cl_context> current; // contexts whose device copy holds the latest data
+        bool host = true; // host memory holds the latest data once pending completes
+        cl_context source = nullptr; // context a kernel wrote the latest data in, while the host is stale
+        cl_command_queue source_queue = nullptr;
+        cl_event pending = nullptr; // last write of the latest data
+        std::atomic<bool> settled{true}; // host current with nothing pending, host access skips the lock
+        std::atomic<bool> fresh{false}; // some device copy may be current
+        void setPending(cl_command_queue, cl_event);
+
+        std::set<cl_context> evicted; // device copies given back to host memory
+
+        std::size_t unit = 1; // bytes of an element, segments don't split one
+        std::vector<std::unique_ptr<Buffer>> segments; // parts of the host memory with device copies of their own, when one allocation can't hold it
+        static std::map<cl_context, std::size_t> limits;
+        static std::mutex limits_lock;
+        static std::size_t getLimit(cl_context);
+        void split(std::size_t);
+
+        static void merge(std::vector<Range>&);
 
 		void copy(const Buffer&);
 		void move(Buffer&);
@@ -192,13 +455,43 @@ namespace ecl{
 		virtual void* getPtr();
 		std::size_t getSize() const;
 		ACCESS getAccess() const;
+		MEMORY getMemory() const;
 
 		void setPtr(void*);
+		void setMemory(MEMORY);
+
+		bool isZeroCopy(cl_context) const;
+		void* getMapping(cl_context) const;
+		void setMapping(cl_context, void*);
+
+		void setTracking(bool);
+		bool isTracking() const;
+		void markDirty(std::size_t, std::size_t, cl_context except = nullptr);
+		bool takeDirty(cl_context, std::vector<Range>&);
+
+		void setCoherent(bool);
+		bool isCoherent() const;
+		bool isCurrent(cl_context) const;
+		bool isHostCurrent() const;
+		void markCurrent(cl_context);
+		void markWritten(cl_context, cl_command_queue, cl_event);
+		void markHost(cl_event);
+		void invalidate();
+		void fetch();
+		void checkHost(bool);
 
 		bool checkBuffer(cl_context) const;
 		void createBuffer(cl_context);
 		void releaseBuffer(cl_context);
 
+		bool isEvicted(cl_context) const;
+		void evict(cl_context);
+
+		bool isSegmented() const;
+		std::vector<Buffer*> getSegments() const;
+		std::size_t getUnit() const;
+		Buffer part(cl_context, std::size_t, std::size_t);
+
 		void clear();
 
 		~Buffer();
@@ -260,12 +553,16 @@ private:
 	T* arr = nullptr;
 	std::size_t arr_size = 0;
 	FREE manage = MANUALLY;
+	bool aligned = false; // storage came from allocate, adopted arrays are freed with delete[]
+
+	static T* allocate(std::size_t, MEMORY);
+	static void deallocate(T*, std::size_t);
 
 	void copy(const array<T>&);
 	void move(array<T>&);
 public:
 	array();
-	explicit array(std::size_t, ACCESS access = READ_WRITE);
+	explicit array(std::size_t, ACCESS access = READ_WRITE, MEMORY memory = COPY);
 	array(const T*, std::size_t, FREE manage = MANUALLY);
 	array(T*, std::size_t, ACCESS, FREE manage = MANUALLY);
 
@@ -281,6 +578,10 @@ public:
 	std::size_t getArraySize() const;
 
 	void view(array<T>&);
+	array<T> slice(std::size_t, std::size_t);
+
+	void touch(std::size_t, std::size_t count = 1);
+	void set(std::size_t, const T&);
 
 	T& operator[](std::size_t);
 	operator T*();
@@ -290,29 +591,203 @@ public:
 	~array();
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Argument Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Argument : public Error{
+    private:
+        const Buffer* buffer = nullptr; // __global memory, bound as cl_mem
+        std::vector<unsigned char> value; // by-value scalar or vector
+        std::size_t local = 0; // __local memory size in bytes
+        bool piecewise = false; // must have one element per work-item, arrays that do are cut to the piece anyway
+    public:
+        Argument(const Buffer*);
+        Argument(const void*, std::size_t);
+        explicit Argument(std::size_t);
+
+        const Buffer* getBuffer() const;
+        bool isValue() const;
+        bool isLocal() const;
+        bool isPiecewise() const;
+
+        friend Argument piecewise(const Buffer*);
+
+        void bind(cl_kernel, std::size_t, cl_context, const std::string&) const;
+    };
+
+    template<typename T>
+    Argument value(const T&);
+    template<typename T>
+    Argument local(std::size_t);
+    Argument piecewise(const Buffer*);
+
 ///////////////////////////////////////////////////////////////////////////////
 // Frame Struct Declaration
 ///////////////////////////////////////////////////////////////////////////////
     struct Frame{
         Program& prog;
         Kernel& kern;
-        const std::vector<const Buffer*> args;
+        const std::vector<Argument> args;
+    };
+///////////////////////////////////////////////////////////////////////////////
+// Event Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Event : public Error{
+    private:
+        cl_event event = nullptr; // empty for operations that enqueued nothing
+
+        static void CL_CALLBACK notify(cl_event, cl_int, void*);
+
+        void copy(const Event&);
+        void move(Event&);
+    public:
+        Event() = default;
+        explicit Event(cl_event);
+
+        Event(const Event&);
+        Event& operator=(const Event&);
+
+        Event(Event&&);
+        Event& operator=(Event&&);
+
+        cl_event getEvent() const;
+        cl_int getStatus() const;
+        bool isComplete() const;
+
+        void await() const;
+        void then(const std::function<void(cl_int)>&);
+
+        static void await(const std::vector<Event>&);
+        static std::vector<cl_event> getWaitList(const std::vector<Event>&);
+
+        void clear();
+        ~Event();
+    };
+
+///////////////////////////////////////////////////////////////////////////////
+// Rect Struct Declaration
+///////////////////////////////////////////////////////////////////////////////
+    struct Rect{ // part of a buffer seen as slices of rows
+        std::vector<std::size_t> origin; // byte in row, row, slice
+        std::size_t row_pitch; // 0 for tightly packed
+        std::size_t slice_pitch;
+    };
+
+    template<typename F>
+    struct Callback : Callback<decltype(&F::operator())>{}; // element type behind the first parameter of a lambda, functor or function
+    template<typename R, typename A, typename B>
+    struct Callback<R(*)(A, B)>{
+        typedef typename std::remove_cv<typename std::remove_pointer<A>::type>::type type;
     };
+    template<typename C, typename R, typename A, typename B>
+    struct Callback<R(C::*)(A, B)> : Callback<R(*)(A, B)>{};
+    template<typename C, typename R, typename A, typename B>
+    struct Callback<R(C::*)(A, B) const> : Callback<R(*)(A, B)>{};
+    template<typename F>
+    struct Callable : std::integral_constant<bool, std::is_class<F>::value || std::is_function<typename std::remove_pointer<F>::type>::value>{}; // data pointers aren't
+
+    class Plan;
+    class Graph;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Computer Class Declaration
 ///////////////////////////////////////////////////////////////////////////////
     class Computer : public Error{
+        public:
+            struct Traffic{
+                std::size_t sent = 0; // bytes
+                std::size_t received = 0;
+                std::size_t staged = 0; // bytes of both that went through pinned staging
+                double send_time = 0; // seconds from enqueue to completion
+                double receive_time = 0;
+            };
         private:
             cl_device_id device = nullptr;
             std::string name = "";
 
             cl_context context = nullptr;
-            cl_command_queue queue = nullptr;
+            cl_command_queue queue = nullptr; // first compute lane
+
+            std::vector<cl_command_queue> lanes; // compute lanes
+            cl_command_queue transfer = nullptr; // same as queue unless there are several lanes
+            std::size_t next_lane = 0;
+
+            struct Hazard{
+                Event write; // last command writing the buffer
+                std::vector<Event> reads; // commands reading it since
+            };
+            struct Hazards{
+                std::map<cl_mem, Hazard> table;
+                std::mutex lock;
+            };
+            std::shared_ptr<Hazards> hazards; // one table for all computers of a context
+            bool tracked = false; // several lanes or a shared context
+
+            struct Staging{
+                cl_mem mem;
+                void* ptr; // pinned host memory, kept mapped
+                Event busy; // last transfer through it
+            };
+            std::vector<Staging> staging;
+            std::size_t staging_size = 4 << 20;
+            std::size_t staging_count = 2;
+            std::mutex staging_lock;
+
+            struct Counters{
+                Traffic traffic;
+                std::mutex lock;
+            };
+            std::shared_ptr<Counters> counters; // outlives the computer in completion callbacks
+
+            Graph* recording = nullptr; // takes send, receive, grid and task instead of running them
+
+            std::size_t max_group_size = 0; // device work-group limits
+            std::vector<std::size_t> max_item_sizes;
+            cl_ulong local_memory = 0;
+
+            static std::map<std::string, std::vector<std::size_t>> tuning; // best local sizes by device, kernel and size class
+            static std::string tuning_file;
+            static std::mutex tuning_lock;
+
+            Computer(std::size_t, const Platform&, DEVICE, cl_context, const std::shared_ptr<Hazards>&, std::size_t);
+            void init(std::size_t);
 
 			void move(Computer&);
+			Kernel::Instance bindFrame(const Frame&, const std::string&);
+
+            bool isTracked() const;
+            void depend(cl_mem, bool, std::vector<Event>&);
+            void track(cl_mem, bool, const Event&);
+            Event hold(cl_mem, bool, const std::string&);
+            void open(const Event&, Event&);
+            Event launch(const std::vector<Argument>&, cl_kernel, const std::vector<std::size_t>&, const std::size_t*, EXEC, const std::vector<Event>&, const std::string&, const std::size_t* offset = nullptr);
+
+            bool isSplit(const Frame&) const;
+            static bool isCut(const Argument&, std::size_t);
+            Event split(const Frame&, const std::vector<std::size_t>&, const std::function<Event(const Frame&, const std::vector<std::size_t>&, const std::vector<Event>&)>&, EXEC, const std::vector<Event>&, const std::string&, std::size_t);
+
+            bool isStaged(std::size_t) const;
+            void checkStaging();
+            void releaseStaging();
+            Event stageSend(cl_mem, std::size_t, const void*, std::size_t, const std::vector<cl_event>&);
+            Event stageReceive(cl_mem, std::size_t, void*, std::size_t, const std::vector<cl_event>&);
+            void count(Event, std::size_t, bool, bool, std::chrono::steady_clock::time_point);
+            Event write(Buffer&, const std::vector<Range>&, EXEC, const std::vector<Event>&);
+            void restore(const Buffer&);
+            Event submit(const std::vector<std::pair<Buffer*, bool>>&, const std::function<cl_int(cl_uint, const cl_event*, cl_event*)>&, EXEC, const std::vector<Event>&, const std::string&);
+            Event read(Buffer&, const std::vector<Range>&, EXEC, const std::vector<Event>&);
+
+            template<typename T, typename U>
+            void pipe(const Frame&, const std::function<std::size_t(T*, std::size_t)>&, const std::function<void(const U*, std::size_t)>&, std::size_t, std::size_t);
+
+            std::string getTuningKey(const Frame&, const std::vector<std::size_t>&) const;
+            std::vector<std::size_t> tune(const Frame&, const std::vector<std::size_t>&);
+            static void saveTuning();
         public:
 			Computer() = delete;
             Computer(std::size_t, const Platform&, DEVICE);
+            Computer(std::size_t, const Platform&, DEVICE, std::size_t);
+            static std::vector<Computer> shared(const Platform&, DEVICE, std::size_t lanes = 0);
 
 			Computer(Computer&&);
 			Computer& operator=(Computer&);
@@ -320,21 +795,65 @@ public:
 			cl_device_id getDevice() const;
 			cl_context getContext() const;
 			cl_command_queue getQueue() const;
+			cl_command_queue getTransferQueue() const;
+			const std::vector<cl_command_queue>& getQueues() const;
             const std::string& getName() const;
 
-			void send(Buffer&, EXEC sync = SYNC);
-			void receive(Buffer&, EXEC sync = SYNC);
+			Event send(Buffer&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event receive(Buffer&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event send(Buffer&, std::size_t, std::size_t, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event receive(Buffer&, std::size_t, std::size_t, EXEC sync = SYNC, const std::vector<Event>& wait = {});
 			void release(Buffer&, EXEC sync = SYNC);
 			void grab(Buffer&, EXEC sync = SYNC);
-
-            void send(const std::vector<Buffer*>&, EXEC sync = SYNC);
-			void receive(const std::vector<Buffer*>&, EXEC sync = SYNC);
+			Event migrate(Buffer&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+
+			Event copy(const Buffer&, Buffer&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event copy(const Buffer&, std::size_t, Buffer&, std::size_t, std::size_t, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event copyRect(const Buffer&, const Rect&, Buffer&, const Rect&, const std::vector<std::size_t>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event fill(Buffer&, const void*, std::size_t, std::size_t, std::size_t, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			template<typename T>
+			Event fill(Buffer&, const T&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			template<typename T>
+			array<T> clone(const array<T>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			static void checkCopy(const Buffer&, std::size_t, const Buffer&, std::size_t, std::size_t);
+			static void checkCopy(const Buffer&, const Rect&, const Buffer&, const Rect&, const std::vector<std::size_t>&);
+			static void checkFill(const Buffer&, const void*, std::size_t, std::size_t, std::size_t);
+
+            Event send(const std::vector<Buffer*>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+			Event receive(const std::vector<Buffer*>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
 			void release(const std::vector<Buffer*>&, EXEC sync = SYNC);
 			void grab(const std::vector<Buffer*>&, EXEC sync = SYNC);
 
-            void grid(const Frame&, const std::vector<std::size_t>&, const std::vector<std::size_t>&, EXEC sync = SYNC);
-            void grid(const Frame&, const std::vector<std::size_t>&, EXEC sync = SYNC);
-            void task(const Frame&, EXEC sync = SYNC);
+            Event grid(const Frame&, const std::vector<std::size_t>&, const std::vector<std::size_t>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+            Event grid(const Frame&, const std::vector<std::size_t>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+            Event grid(const Frame&, const std::vector<std::size_t>&, LOCAL, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+            Event task(const Frame&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+
+            std::vector<std::size_t> getLocalSize(const Frame&, const std::vector<std::size_t>&, LOCAL);
+            static std::size_t getPiece(const Frame&, const std::vector<std::size_t>&, std::size_t multiple = 1);
+            Plan prepare(const Frame&);
+
+            template<typename P, typename C, typename = typename std::enable_if<Callable<P>::value && Callable<C>::value>::type>
+            void stream(const Frame&, P, C, std::size_t, std::size_t depth = 2);
+            template<typename T, typename U>
+            void stream(const Frame&, const T*, U*, std::size_t, std::size_t, std::size_t depth = 2);
+
+            static void setTuning(const std::string&);
+            static void retune();
+
+            void record(Graph&);
+            void stop();
+
+            void setBudget(std::size_t);
+            std::size_t getBudget() const;
+            void setLimit(std::size_t);
+            std::size_t getLimit() const;
+            Memory::Stats getMemoryStats() const;
+            std::vector<Memory::Usage> getLargest(std::size_t count = 10) const;
+
+            void setStaging(std::size_t, std::size_t count = 2);
+            Traffic getTraffic() const;
+            void resetTraffic();
 
             void await();
 
@@ -343,16 +862,155 @@ public:
             friend std::ostream& operator<<(std::ostream&, const Computer&);
 			friend Computer& operator<<(Computer&, Buffer&);
 			friend Computer& operator>>(Computer&, Buffer&);
+            friend class Cluster;
+            friend class Graph;
+            friend class Plan;
 
 			void clear();
             ~Computer();
     };
+
+///////////////////////////////////////////////////////////////////////////////
+// Plan Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Plan : public Error{ // launches through its computer, which must outlive it
+    private:
+        Computer* video = nullptr;
+        cl_context context = nullptr;
+        cl_kernel kernel = nullptr; // own instance, so other launches can't clobber bound arguments
+
+        std::vector<Argument> args;
+        std::vector<cl_mem> bound; // last cl_mem set for every buffer argument
+
+        void bind(const std::string&);
+        void unpin();
+        Event run(const std::vector<std::size_t>&, const std::size_t*, EXEC, const std::vector<Event>&, const std::string&);
+        void move(Plan&);
+    public:
+        Plan(Computer&, const Frame&);
+
+        Plan(const Plan&) = delete;
+        Plan& operator=(const Plan&) = delete;
+
+        Plan(Plan&&);
+        Plan& operator=(Plan&&);
+
+        cl_kernel getKernel() const;
+        void set(std::size_t, const Argument&);
+
+        Event grid(const std::vector<std::size_t>&, const std::vector<std::size_t>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+        Event grid(const std::vector<std::size_t>&, EXEC sync = SYNC, const std::vector<Event>& wait = {});
+        Event task(EXEC sync = SYNC, const std::vector<Event>& wait = {});
+
+        void clear();
+        ~Plan();
+    };
+
+///////////////////////////////////////////////////////////////////////////////
+// Graph Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Graph : public Error{ // recorded sequence of transfers and launches, replayed with precomputed dependencies
+    private:
+        enum KIND{SEND, RECEIVE, LAUNCH};
+        struct Node{
+            KIND kind;
+            Buffer* buffer; // transfers
+            std::unique_ptr<Plan> plan; // launches
+            std::vector<std::size_t> global; // empty for a task
+            std::vector<std::size_t> local; // empty leaves it to the driver
+            std::vector<std::size_t> deps; // earlier nodes it waits for
+            std::vector<Buffer*> args; // buffers of a launch
+        };
+        struct Access{
+            bool written = false;
+            std::size_t write = 0; // last node writing the buffer
+            std::vector<std::size_t> reads; // nodes reading it since
+        };
+
+        cl_context context = nullptr;
+        cl_command_queue queue = nullptr;
+        cl_command_queue transfer = nullptr;
+
+        std::vector<Node> nodes;
+        std::map<const Buffer*, Access> access;
+        Event last; // end of the previous replay
+        Computer* recorder = nullptr; // computer recording into the graph, detached when the graph goes
+
+        void begin(Computer&);
+        void add(Node, const std::vector<std::pair<const Buffer*, bool>>&);
+        void send(Buffer&);
+        void receive(Buffer&);
+        void grid(Computer&, const Frame&, const std::vector<std::size_t>&, const std::vector<std::size_t>&);
+
+        void move(Graph&);
+    public:
+        Graph() = default;
+
+        Graph(const Graph&) = delete;
+        Graph& operator=(const Graph&) = delete;
+
+        Graph(Graph&&);
+        Graph& operator=(Graph&&);
+
+        std::size_t getSize() const;
+        Event run(EXEC sync = SYNC, const std::vector<Event>& wait = {});
+
+        friend class Computer;
+
+        void clear();
+        ~Graph();
+    };
+
+///////////////////////////////////////////////////////////////////////////////
+// Warmup Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Warmup : public Error{
+    private:
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors; // one slot per thread
+
+        void join();
+    public:
+        Warmup(const std::vector<Frame>&, const std::vector<Computer*>&);
+
+        Warmup(const Warmup&) = delete;
+        Warmup& operator=(const Warmup&) = delete;
+
+        Warmup(Warmup&&) = default;
+        Warmup& operator=(Warmup&&) = delete;
+
+        void await();
+        ~Warmup();
+    };
+
+///////////////////////////////////////////////////////////////////////////////
+// Cluster Class Declaration
+///////////////////////////////////////////////////////////////////////////////
+    class Cluster : public Error{ // one 1-D grid split between several computers
+    private:
+        std::vector<Computer*> computers;
+        std::vector<double> rates; // work-items per second of every computer, averaged over runs
+        mutable std::mutex lock; // guards rates
+
+        void parallel(const std::function<void(std::size_t)>&);
+        std::vector<double> getShares() const;
+    public:
+        Cluster(const std::vector<Computer*>&);
+
+        Cluster(const Cluster&) = delete;
+        Cluster& operator=(const Cluster&) = delete;
+
+        const std::vector<Computer*>& getComputers() const;
+        std::vector<double> getRates() const;
+
+        void grid(const Frame&, std::size_t, std::size_t granule = 64);
+    };
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Error Class Definition
 ///////////////////////////////////////////////////////////////////////////////
-int ecl::Error::error = 0;
+thread_local int ecl::Error::error = 0;
 
 void ecl::Error::checkError(const std::string& where){
     if (error != 0)
@@ -730,32 +1388,206 @@ void ecl::System::release(){
 ///////////////////////////////////////////////////////////////////////////////
 // Program Class Definition
 ///////////////////////////////////////////////////////////////////////////////
-std::string ecl::Program::getBuildError(cl_context context, cl_device_id device){
+std::string ecl::Program::getBuildError(cl_program prog, cl_device_id device){
+    std::size_t info_size;
+    clGetProgramBuildInfo(prog, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &info_size);
+
+    std::string info(info_size, '\0');
+    clGetProgramBuildInfo(prog, device, CL_PROGRAM_BUILD_LOG, info_size, &info[0], nullptr);
+
+    return info.c_str();
+}
+
+std::string ecl::Program::cache;
+
+// FNV-1a, stable between runs and platforms unlike std::hash
+std::uint64_t ecl::Program::hash(const std::string& data){
+    std::uint64_t result = 14695981039346656037ULL;
+    for(unsigned char c : data){
+        result ^= c;
+        result *= 1099511628211ULL;
+    }
+    return result;
+}
+
+std::string ecl::Program::getDeviceString(cl_device_id device, cl_device_info info){
+    std::size_t info_size;
+    error = clGetDeviceInfo(device, info, 0, nullptr, &info_size);
+    checkError("Program [get device info]");
+
+    std::string result(info_size, '\0');
+    error = clGetDeviceInfo(device, info, info_size, &result[0], nullptr);
+    checkError("Program [get device info]");
+
+    return result.c_str();
+}
+
+std::vector<cl_device_id> ecl::Program::getContextDevices(cl_context context){
     std::size_t info_size;
-    clGetProgramBuildInfo(program.at(context), device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &info_size);
+    error = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, nullptr, &info_size);
+    checkError("Program [get context devices]");
+
+    std::vector<cl_device_id> result(info_size / sizeof(cl_device_id));
+    error = clGetContextInfo(context, CL_CONTEXT_DEVICES, info_size, result.data(), nullptr);
+    checkError("Program [get context devices]");
+
+    return result;
+}
+
+std::string ecl::Program::getSignature() const{
+    std::string result = std::to_string(hash(source)) + "|" + std::to_string(source.size());
+    for(const auto* m : modules) result += "+" + m->getSignature();
+    return result;
+}
+
+std::string ecl::Program::getCacheKey(cl_device_id device, const std::string& options) const{
+    return getSignature() + "\n" +
+            options + "\n" +
+            getDeviceString(device, CL_DEVICE_NAME) + "\n" +
+            getDeviceString(device, CL_DEVICE_VERSION) + "\n" +
+            getDeviceString(device, CL_DRIVER_VERSION);
+}
+std::string ecl::Program::getCacheFile(const std::string& key) const{
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash(key));
+    return cache + "/" + name + ".eclbin";
+}
+
+// entry layout: magic, key size, key, binary size, binary, binary hash
+cl_program ecl::Program::loadBinary(cl_context context, const std::string& options) const{
+    auto devices = getContextDevices(context);
+
+    std::vector<std::string> binaries;
+    for(auto device : devices){
+        std::string key = getCacheKey(device, options);
+        std::ifstream f(getCacheFile(key), std::ios::binary);
+        if(!f.is_open()) return nullptr;
+
+        char magic[4];
+        std::uint64_t key_size = 0, binary_size = 0, binary_hash = 0;
+
+        f.read(magic, sizeof(magic));
+        if(!f || std::memcmp(magic, "ECLB", sizeof(magic)) != 0) return nullptr;
+
+        f.read((char*)&key_size, sizeof(key_size));
+        if(!f || key_size != key.size()) return nullptr;
+
+        std::string stored(key_size, '\0');
+        f.read(&stored[0], key_size);
+        if(!f || stored != key) return nullptr;
+
+        f.read((char*)&binary_size, sizeof(binary_size));
+        if(!f || binary_size == 0) return nullptr;
+
+        std::string binary(binary_size, '\0');
+        f.read(&binary[0], binary_size);
+        f.read((char*)&binary_hash, sizeof(binary_hash));
+        if(!f || binary_hash != hash(binary)) return nullptr;
+
+        binaries.push_back(std::move(binary));
+    }
 
-    char* info = new char[info_size];
-    clGetProgramBuildInfo(program.at(context), device, CL_PROGRAM_BUILD_LOG, info_size, info, nullptr);
+    std::vector<std::size_t> lengths;
+    std::vector<const unsigned char*> data;
+    for(const auto& b : binaries){
+        lengths.push_back(b.size());
+        data.push_back((const unsigned char*)b.data());
+    }
+
+    cl_int load_error;
+    std::vector<cl_int> status(devices.size());
+    cl_program result = clCreateProgramWithBinary(context, devices.size(), devices.data(), lengths.data(), data.data(), status.data(), &load_error);
+    if(load_error != 0) return nullptr;
+
+    for(auto st : status) load_error |= st;
+    if(load_error == 0) load_error = clBuildProgram(result, 0, nullptr, options.empty() ? nullptr : options.c_str(), nullptr, nullptr);
+
+    // stale or corrupt entry: caller rebuilds from source and overwrites it
+    if(load_error != 0){
+        clReleaseProgram(result);
+        return nullptr;
+    }
+
+    return result;
+}
+
+void ecl::Program::saveBinary(cl_program prog, const std::string& options) const{
+    cl_uint count;
+    error = clGetProgramInfo(prog, CL_PROGRAM_NUM_DEVICES, sizeof(count), &count, nullptr);
+    checkError("Program [save binary]");
+
+    std::vector<cl_device_id> devices(count);
+    error = clGetProgramInfo(prog, CL_PROGRAM_DEVICES, count * sizeof(cl_device_id), devices.data(), nullptr);
+    checkError("Program [save binary]");
+
+    std::vector<std::size_t> lengths(count);
+    error = clGetProgramInfo(prog, CL_PROGRAM_BINARY_SIZES, count * sizeof(std::size_t), lengths.data(), nullptr);
+    checkError("Program [save binary]");
+
+    std::vector<std::string> binaries;
+    std::vector<unsigned char*> data;
+    for(auto l : lengths) binaries.emplace_back(l, '\0');
+    for(auto& b : binaries) data.push_back((unsigned char*)&b[0]);
+
+    error = clGetProgramInfo(prog, CL_PROGRAM_BINARIES, count * sizeof(unsigned char*), data.data(), nullptr);
+    checkError("Program [save binary]");
+
+    for(std::size_t i = 0; i < count; i++){
+        const auto& binary = binaries[i];
+        if(binary.empty()) continue;
+
+        std::string key = getCacheKey(devices[i], options);
+        std::string filename = getCacheFile(key);
+        std::string temp = filename + "." + std::to_string(hash(std::to_string((std::uintptr_t)prog) + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()))) + ".tmp";
 
-    return info;
+        std::uint64_t key_size = key.size(), binary_size = binary.size(), binary_hash = hash(binary);
+
+        std::ofstream f(temp, std::ios::binary | std::ios::trunc);
+        if(!f.is_open()) continue; // cache is best effort
+
+        f.write("ECLB", 4);
+        f.write((const char*)&key_size, sizeof(key_size));
+        f.write(key.data(), key.size());
+        f.write((const char*)&binary_size, sizeof(binary_size));
+        f.write(binary.data(), binary.size());
+        f.write((const char*)&binary_hash, sizeof(binary_hash));
+        f.close();
+
+        // rename is atomic, so concurrent processes never read a half written entry
+        if(!f || std::rename(temp.c_str(), filename.c_str()) != 0) std::remove(temp.c_str());
+    }
 }
 
 void ecl::Program::copy(const Program& other) {
 	clear();
 	source = other.source;
+	options = other.options;
+	modules = other.modules;
 }
 void ecl::Program::move(Program& other) {
 	clear();
+	std::lock_guard<std::mutex> guard(other.lock);
 	source = std::move(other.source);
+	options = std::move(other.options);
 	program = std::move(other.program);
-
-	other.clear();
+	object = std::move(other.object);
+	modules = std::move(other.modules);
+	other.program.clear();
+	other.object.clear();
+	other.modules.clear();
+	other.source.clear();
+	other.options.clear();
 }
 
 void ecl::Program::clear(){
+    std::lock_guard<std::mutex> guard(lock);
     for(const auto& p : program) clReleaseProgram(p.second);
+    for(const auto& p : object) clReleaseProgram(p.second);
     source.clear();
+    options.clear();
     program.clear();
+    object.clear();
+    modules.clear();
 }
 
 ecl::Program::Program(const char* src){
@@ -764,6 +1596,10 @@ ecl::Program::Program(const char* src){
 ecl::Program::Program(const std::string& src){
     source = src;
 }
+ecl::Program::Program(const std::string& src, const std::string& options){
+    source = src;
+    this->options = options;
+}
 
 ecl::Program::Program(const Program& other){
 	copy(other);
@@ -794,12 +1630,32 @@ ecl::Program ecl::Program::load(const std::string& filename){
     return result;
 }
 
+void ecl::Program::setCache(const std::string& directory){
+    cache = directory;
+}
+const std::string& ecl::Program::getCache(){
+    return cache;
+}
+
 cl_program ecl::Program::getProgram(cl_context context) const{
-    return program.at(context);
+    return getProgram(context, options);
+}
+cl_program ecl::Program::getProgram(cl_context context, const std::string& options) const{
+    std::lock_guard<std::mutex> guard(lock);
+    return program.at(std::make_pair(context, options));
 }
 const std::string& ecl::Program::getSource() const{
     return source;
 }
+const std::string& ecl::Program::getOptions() const{
+    return options;
+}
+const std::vector<ecl::Program*>& ecl::Program::getModules() const{
+    return modules;
+}
+std::uint64_t ecl::Program::getHash() const{
+    return hash(getSignature());
+}
 
 namespace ecl{
     std::ostream& operator<<(std::ostream& s, const Program& other){
@@ -809,11 +1665,16 @@ namespace ecl{
 }
 
 void ecl::Program::setSource(const std::string& src){
-    if(program.size() == 0){
+    std::lock_guard<std::mutex> guard(lock);
+    if(program.size() == 0 && object.size() == 0){
         source = src;
     }
     else throw std::runtime_error("unable to change program until it's using");
 }
+// built variants are kept, so switching options back and forth doesn't rebuild
+void ecl::Program::setOptions(const std::string& options){
+    this->options = options;
+}
 
 
 ecl::Program& ecl::Program::operator=(const std::string& src){
@@ -856,19 +1717,132 @@ ecl::Program ecl::Program::operator+(const Program& other){
 
 
 bool ecl::Program::checkProgram(cl_context context, cl_device_id device){
-    if(program.find(context) == program.end()){
-        const char* src = source.c_str();
-        std::size_t len  = source.size();
+    return checkProgram(context, device, options);
+}
+// unlike operator+=, linked modules are compiled once per context and only relinked
+ecl::Program& ecl::Program::link(Program& module){
+    std::lock_guard<std::mutex> guard(lock);
+    if(program.size() == 0) modules.push_back(&module);
+    else throw std::runtime_error("unable to link program until it's using");
 
-        program.emplace(context, clCreateProgramWithSource(context, 1, (const char**)&src, (const std::size_t*)&len, &error));
-        checkError("Program [check]");
+    return *this;
+}
 
-        error = clBuildProgram(program.at(context), 0, nullptr, nullptr, nullptr, nullptr);
-        if(error != 0) throw std::runtime_error(getBuildError(context, device));
+std::string ecl::Program::getLinkOptions(const std::string& options){
+    static const char* allowed[] = {"-cl-denorms-are-zero", "-cl-no-signed-zeros", "-cl-unsafe-math-optimizations",
+                                    "-cl-finite-math-only", "-cl-fast-relaxed-math"};
+    std::string result;
+    std::size_t begin = 0;
+    while(begin < options.size()){
+        std::size_t end = options.find(' ', begin);
+        if(end == std::string::npos) end = options.size();
+
+        std::string option = options.substr(begin, end - begin);
+        for(const char* a : allowed){
+            if(option == a){
+                result += (result.empty() ? "" : " ") + option;
+                break;
+            }
+        }
+        begin = end + 1;
+    }
+    return result;
+}
 
-        return false;
+cl_program ecl::Program::buildSource(cl_context context, cl_device_id device, const std::string& options){
+    const char* src = source.c_str();
+    std::size_t len  = source.size();
+
+    cl_program result = clCreateProgramWithSource(context, 1, (const char**)&src, (const std::size_t*)&len, &error);
+    checkError("Program [check]");
+
+    error = clBuildProgram(result, 0, nullptr, options.empty() ? nullptr : options.c_str(), nullptr, nullptr);
+    if(error != 0){
+        std::string log = getBuildError(result, device);
+        clReleaseProgram(result);
+        throw std::runtime_error(log);
     }
-    return true;
+
+    return result;
+}
+
+cl_program ecl::Program::buildLinked(cl_context context, cl_device_id device, const std::string& options){
+    std::vector<Program*> linked;
+    collect(linked);
+
+    std::vector<cl_program> objects;
+    if(!source.empty()) objects.push_back(checkObject(context, device, options));
+    for(auto* m : linked) if(!m->source.empty()) objects.push_back(m->checkObject(context, device, options));
+
+    std::string link_options = getLinkOptions(options);
+    cl_program result = clLinkProgram(context, 0, nullptr, link_options.empty() ? nullptr : link_options.c_str(),
+                                      objects.size(), objects.data(), nullptr, nullptr, &error);
+    if(error != 0){
+        if(result == nullptr) checkError("Program [link]");
+
+        std::string log = getBuildError(result, device);
+        clReleaseProgram(result);
+        throw std::runtime_error(log);
+    }
+
+    return result;
+}
+
+// modules of modules too, each once, so a library shared by two modules isn't linked twice
+void ecl::Program::collect(std::vector<Program*>& result){
+    for(auto* m : modules){
+        if(m == this || std::find(result.begin(), result.end(), m) != result.end()) continue;
+        result.push_back(m);
+        m->collect(result);
+    }
+}
+
+bool ecl::Program::checkProgram(cl_context context, cl_device_id device, const std::string& options){
+    auto key = std::make_pair(context, options);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(program.find(key) != program.end()) return true;
+    }
+
+    cl_program result = cache.empty() ? nullptr : loadBinary(context, options);
+    if(result == nullptr){
+        result = modules.empty() ? buildSource(context, device, options) : buildLinked(context, device, options);
+        if(!cache.empty()) saveBinary(result, options);
+    }
+
+    // another thread may have built the same variant meanwhile
+    std::lock_guard<std::mutex> guard(lock);
+    if(!program.emplace(key, result).second) clReleaseProgram(result);
+
+    return false;
+}
+
+cl_program ecl::Program::checkObject(cl_context context, cl_device_id device, const std::string& options){
+    auto key = std::make_pair(context, options);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = object.find(key);
+        if(it != object.end()) return it->second;
+    }
+
+    const char* src = source.c_str();
+    std::size_t len  = source.size();
+
+    cl_program result = clCreateProgramWithSource(context, 1, (const char**)&src, (const std::size_t*)&len, &error);
+    checkError("Program [compile]");
+
+    error = clCompileProgram(result, 0, nullptr, options.empty() ? nullptr : options.c_str(), 0, nullptr, nullptr, nullptr, nullptr);
+    if(error != 0){
+        std::string log = getBuildError(result, device);
+        clReleaseProgram(result);
+        throw std::runtime_error(log);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = object.emplace(key, result);
+    if(!it.second) clReleaseProgram(result);
+
+    return it.first->second;
 }
 
 ecl::Program::~Program(){
@@ -884,16 +1858,30 @@ void ecl::Kernel::copy(const Kernel& other) {
 }
 void ecl::Kernel::move(Kernel& other) {
 	clear();
+	std::lock_guard<std::mutex> guard(other.lock);
 
 	name = std::move(other.name);
 	kernel = std::move(other.kernel);
+	idle = std::move(other.idle);
+	extra = std::move(other.extra);
+	info = std::move(other.info);
 
-	other.clear();
+	other.name.clear();
+	other.kernel.clear();
+	other.idle.clear();
+	other.extra.clear();
+	other.info.clear();
 }
 
 void ecl::Kernel::clear(){
+    std::lock_guard<std::mutex> guard(lock);
     for(const auto& p : kernel) clReleaseKernel(p.second);
+    for(auto k : extra) clReleaseKernel(k);
     name.clear();
+    kernel.clear();
+    idle.clear();
+    extra.clear();
+    info.clear();
 }
 ecl::Kernel::Kernel(const char* name){
     this->name = name;
@@ -928,6 +1916,7 @@ namespace ecl{
 }
 
 void ecl::Kernel::setName(const std::string& name){
+    std::lock_guard<std::mutex> guard(lock);
     if(kernel.size() == 0) this->name = name;
     else throw std::runtime_error("unable to change kernel name until it's using");
 }
@@ -975,32 +1964,719 @@ ecl::Kernel ecl::Kernel::operator+(const Kernel& other){
 
 
 cl_kernel ecl::Kernel::getKernel(cl_program program) const{
+    std::lock_guard<std::mutex> guard(lock);
     return kernel.at(program);
 }
+ecl::Kernel::Info ecl::Kernel::getInfo(cl_program program, cl_device_id device){
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto key = std::make_pair(program, device);
+    auto it = info.find(key);
+    if(it != info.end()) return it->second;
+
+    cl_kernel kern = kernel.at(program);
+    Info result;
+
+    error = clGetKernelWorkGroupInfo(kern, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(result.work_group_size), &result.work_group_size, nullptr);
+    checkError("Kernel [get info]");
+
+    error = clGetKernelWorkGroupInfo(kern, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(result.preferred_multiple), &result.preferred_multiple, nullptr);
+    checkError("Kernel [get info]");
+    if(result.preferred_multiple == 0) result.preferred_multiple = 1;
+
+    error = clGetKernelWorkGroupInfo(kern, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(result.compile_work_group_size), result.compile_work_group_size, nullptr);
+    checkError("Kernel [get info]");
+
+    error = clGetKernelWorkGroupInfo(kern, device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(result.local_memory), &result.local_memory, nullptr);
+    checkError("Kernel [get info]");
+
+    error = clGetKernelWorkGroupInfo(kern, device, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(result.private_memory), &result.private_memory, nullptr);
+    checkError("Kernel [get info]");
+
+    info.emplace(key, result);
+    return result;
+}
+
 bool ecl::Kernel::checkKernel(cl_program program){
+    std::lock_guard<std::mutex> guard(lock);
     if(kernel.find(program) == kernel.end()){
-        kernel.emplace(program, clCreateKernel(program, name.c_str(), &error));
+        cl_kernel result = clCreateKernel(program, name.c_str(), &error);
         checkError("Kernel [check]");
+        kernel.emplace(program, result);
+        idle[program].push_back(result);
         return false;
     }
     return true;
 }
 
-ecl::Kernel::~Kernel(){
-    clear();
-}
+// the first launch reuses the cached kernel, concurrent ones get extra instances
+cl_kernel ecl::Kernel::borrow(cl_program program){
+    std::lock_guard<std::mutex> guard(lock);
 
-///////////////////////////////////////////////////////////////////////////////
-// Buffer Class Definition
-///////////////////////////////////////////////////////////////////////////////
-void ecl::Buffer::copy(const Buffer& other) {
-	clear();
+    auto& free = idle[program];
+    if(!free.empty()){
+        cl_kernel result = free.back();
+        free.pop_back();
+        return result;
+    }
 
-	ptr = other.ptr;
-	size = other.size;
-	access = other.access;
+    cl_kernel result = clCreateKernel(program, name.c_str(), &error);
+    checkError("Kernel [borrow]");
+    extra.push_back(result);
 
-	for (auto& p : other.buffer) createBuffer(p.first);
+    return result;
+}
+void ecl::Kernel::restore(cl_program program, cl_kernel kern){
+    std::lock_guard<std::mutex> guard(lock);
+    idle[program].push_back(kern);
+}
+
+ecl::Kernel::Instance::Instance(Kernel& owner, cl_program program){
+    this->owner = &owner;
+    this->program = program;
+    kernel = owner.borrow(program);
+}
+ecl::Kernel::Instance::Instance(Instance&& other){
+    owner = other.owner;
+    program = other.program;
+    kernel = other.kernel;
+
+    other.owner = nullptr;
+    other.program = nullptr;
+    other.kernel = nullptr;
+}
+ecl::Kernel::Instance::operator cl_kernel() const{
+    return kernel;
+}
+ecl::Kernel::Instance::~Instance(){
+    if(owner != nullptr) owner->restore(program, kernel);
+}
+
+ecl::Kernel::~Kernel(){
+    clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pool Class Definition
+///////////////////////////////////////////////////////////////////////////////
+std::map<cl_context, ecl::Pool::Heap> ecl::Pool::heaps;
+std::mutex ecl::Pool::lock;
+std::size_t ecl::Pool::slab_size = 16 << 20;
+std::size_t ecl::Pool::high = 256 << 20;
+std::size_t ecl::Pool::low = 64 << 20;
+
+std::size_t ecl::Pool::getAlign(cl_context context){
+    std::size_t info_size;
+    error = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, nullptr, &info_size);
+    checkError("Pool [align]");
+
+    std::vector<cl_device_id> devices(info_size / sizeof(cl_device_id));
+    error = clGetContextInfo(context, CL_CONTEXT_DEVICES, info_size, devices.data(), nullptr);
+    checkError("Pool [align]");
+
+    std::size_t result = 256;
+    for(auto device : devices){
+        cl_uint bits;
+        error = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(bits), &bits, nullptr);
+        checkError("Pool [align]");
+
+        result = std::max(result, std::size_t(bits / 8));
+    }
+    return result;
+}
+
+// small blocks come 64 to a slab, larger ones fill slab_size
+ecl::Pool::Slab* ecl::Pool::getSlab(cl_context context, Heap& heap, std::size_t block){
+    auto& slabs = heap.classes[block];
+    for(auto& slab : slabs){
+        if(slab->free.empty()) continue;
+
+        if(slab->used == 0) heap.stats.idle -= slab->size;
+        heap.stats.hits++;
+        return slab.get();
+    }
+
+    std::size_t bytes = std::max(block, std::min(slab_size, block * 64));
+    cl_mem mem = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, nullptr, &error);
+    if(error == CL_MEM_OBJECT_ALLOCATION_FAILURE || error == CL_OUT_OF_RESOURCES){
+        trim(heap, 0); // idle slabs of other sizes may be in the way
+        mem = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, nullptr, &error);
+    }
+    checkError("Pool [create]");
+
+    Slab* slab = new Slab{mem, bytes, {}, 0};
+    slabs.emplace_back(slab);
+    for(std::size_t offset = bytes; offset >= block; offset -= block) slab->free.push_back(offset - block);
+
+    heap.stats.reserved += bytes;
+    heap.stats.slabs++;
+    heap.stats.misses++;
+    return slab;
+}
+
+void ecl::Pool::trim(Heap& heap, std::size_t target){
+    for(auto& c : heap.classes){
+        auto& slabs = c.second;
+        for(auto it = slabs.begin(); it != slabs.end() && heap.stats.idle > target;){
+            if((*it)->used != 0){
+                it++;
+                continue;
+            }
+            clReleaseMemObject((*it)->mem);
+
+            heap.stats.idle -= (*it)->size;
+            heap.stats.reserved -= (*it)->size;
+            heap.stats.slabs--;
+            heap.stats.trimmed++;
+            it = slabs.erase(it);
+        }
+    }
+}
+
+// buffers larger than a slab are allocated with their exact size
+// zero-copy buffers with host flags are allocated on their own too
+cl_mem ecl::Pool::create(cl_context context, ACCESS access, std::size_t size, cl_mem_flags host, void* ptr){
+    std::unique_lock<std::mutex> guard(lock);
+    if(size == 0 || slab_size == 0 || size > slab_size || host != 0){
+        guard.unlock();
+
+        cl_mem result = clCreateBuffer(context, access | host, size, ptr, &error);
+        checkError("Pool [create]");
+
+        guard.lock();
+        Heap& heap = heaps[context];
+        heap.direct.emplace(result, size);
+        heap.stats.direct += size;
+        return result;
+    }
+
+    Heap& heap = heaps[context];
+    if(heap.align == 0) heap.align = getAlign(context);
+
+    std::size_t block = heap.align;
+    while(block < size) block *= 2;
+
+    Slab* slab = getSlab(context, heap, block);
+    std::size_t offset = slab->free.back();
+
+    cl_buffer_region region = {offset, size};
+    cl_mem result = clCreateSubBuffer(slab->mem, access, CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+    if(error != 0 && slab->used == 0) heap.stats.idle += slab->size;
+    checkError("Pool [create]");
+
+    slab->free.pop_back();
+    slab->used++;
+    heap.blocks.emplace(result, Block{slab, offset, size, {}});
+
+    heap.stats.used += size;
+    heap.stats.blocks++;
+    return result;
+}
+
+// sub-buffers can't nest, so the region is taken from the root buffer of the parent
+cl_mem ecl::Pool::slice(cl_context context, cl_mem parent, ACCESS access, std::size_t offset, std::size_t size){
+    cl_mem root = nullptr;
+    std::size_t origin = 0;
+    error = clGetMemObjectInfo(parent, CL_MEM_ASSOCIATED_MEMOBJECT, sizeof(root), &root, nullptr);
+    checkError("Pool [slice]");
+    if(root != nullptr){
+        error = clGetMemObjectInfo(parent, CL_MEM_OFFSET, sizeof(origin), &origin, nullptr);
+        checkError("Pool [slice]");
+    }
+    else root = parent;
+
+    cl_buffer_region region = {origin + offset, size};
+    cl_mem result = clCreateSubBuffer(root, access, CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+    if(error == CL_MISALIGNED_SUB_BUFFER_OFFSET) throw std::runtime_error("Pool [slice]: offset isn't aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN");
+    checkError("Pool [slice]");
+
+    error = clRetainMemObject(parent);
+    checkError("Pool [slice]");
+
+    std::lock_guard<std::mutex> guard(lock);
+    Heap& heap = heaps[context];
+    heap.views.emplace(result, parent);
+    heap.refs[parent]++;
+    return result;
+}
+
+// another owner of the same memory, the block stays taken until every owner released it
+void ecl::Pool::retain(cl_context context, cl_mem mem){
+    error = clRetainMemObject(mem);
+    checkError("Pool [retain]");
+
+    std::lock_guard<std::mutex> guard(lock);
+    heaps[context].refs[mem]++;
+}
+
+// commands on other lanes keep the block of the memory, or of the buffer it was sliced from, taken
+void ecl::Pool::use(cl_context context, cl_mem mem, cl_event e){
+    if(e == nullptr) return;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto h = heaps.find(context);
+    if(h == heaps.end()) return;
+
+    for(auto v = h->second.views.find(mem); v != h->second.views.end(); v = h->second.views.find(mem)) mem = v->second;
+    auto it = h->second.blocks.find(mem);
+    if(it == h->second.blocks.end()) return;
+
+    const std::size_t PRUNE = 16;
+    auto& busy = it->second.busy;
+    if(busy.size() >= PRUNE) settle(busy);
+
+    clRetainEvent(e);
+    busy.push_back(e);
+}
+
+// completed or failed commands are forgotten
+void ecl::Pool::settle(std::vector<cl_event>& busy){
+    std::vector<cl_event> pending;
+    for(cl_event e : busy){
+        cl_int status = CL_COMPLETE;
+        clGetEventInfo(e, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+
+        if(status > CL_COMPLETE) pending.push_back(e);
+        else clReleaseEvent(e);
+    }
+    busy.swap(pending);
+}
+
+void ecl::Pool::recycle(Heap& heap, const Block& block){
+    Slab* slab = block.slab;
+    slab->free.push_back(block.offset);
+    if(--slab->used == 0) heap.stats.idle += slab->size;
+
+    heap.stats.used -= block.size;
+    heap.stats.blocks--;
+
+    if(heap.stats.idle > high) trim(heap, low);
+}
+
+// blocks still busy are left to the caller, the slab keeps them taken meanwhile
+void ecl::Pool::drop(Heap& heap, cl_mem mem, std::vector<Block>& busy){
+    auto r = heap.refs.find(mem);
+    if(r != heap.refs.end()){
+        if(--r->second == 0) heap.refs.erase(r);
+        return;
+    }
+
+    auto v = heap.views.find(mem);
+    if(v != heap.views.end()){
+        cl_mem parent = v->second;
+        heap.views.erase(v);
+
+        clReleaseMemObject(parent);
+        drop(heap, parent, busy);
+        return;
+    }
+
+    auto it = heap.blocks.find(mem);
+    if(it != heap.blocks.end()){
+        Block block = std::move(it->second);
+        heap.blocks.erase(it);
+
+        settle(block.busy);
+        if(block.busy.empty()) recycle(heap, block);
+        else busy.push_back(std::move(block));
+        return;
+    }
+
+    auto d = heap.direct.find(mem);
+    if(d != heap.direct.end()){
+        heap.stats.direct -= d->second;
+        heap.direct.erase(d);
+    }
+}
+
+void CL_CALLBACK ecl::Pool::retire(cl_event, cl_int, void* data){
+    auto* retired = static_cast<Retired*>(data);
+    if(--retired->count != 0) return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto h = heaps.find(retired->context);
+        if(h != heaps.end()) recycle(h->second, retired->block);
+    }
+    delete retired;
+}
+
+// memory not made by the pool is just released; a block other lanes still use is
+// handed out again from the completion callback of their last command
+void ecl::Pool::release(cl_context context, cl_mem mem){
+    std::vector<Block> busy;
+    cl_int status;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        status = clReleaseMemObject(mem);
+
+        auto h = heaps.find(context);
+        if(h != heaps.end()) drop(h->second, mem, busy);
+    }
+
+    // callbacks may run right away on this thread, so the lock is given up first
+    for(auto& block : busy){
+        auto* retired = new Retired{context, Block{block.slab, block.offset, block.size, {}}, {block.busy.size()}};
+        for(cl_event e : block.busy){
+            if(clSetEventCallback(e, CL_COMPLETE, retire, retired) != CL_SUCCESS){
+                clWaitForEvents(1, &e);
+                retire(e, CL_COMPLETE, retired);
+            }
+            clReleaseEvent(e);
+        }
+    }
+
+    error = status;
+    checkError("Pool [release]");
+}
+
+// the buffer a view was sliced from, so aliasing buffers share their hazards
+cl_mem ecl::Pool::getOwner(cl_context context, cl_mem mem){
+    std::lock_guard<std::mutex> guard(lock);
+    auto h = heaps.find(context);
+    if(h == heaps.end()) return mem;
+
+    for(auto v = h->second.views.find(mem); v != h->second.views.end(); v = h->second.views.find(mem)) mem = v->second;
+    return mem;
+}
+
+// slices or other owners still use the memory
+bool ecl::Pool::isShared(cl_context context, cl_mem mem){
+    std::lock_guard<std::mutex> guard(lock);
+    auto h = heaps.find(context);
+    return h != heaps.end() && h->second.refs.find(mem) != h->second.refs.end();
+}
+
+// gives idle slabs back, the context is forgotten once nothing is left
+void ecl::Pool::trim(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto h = heaps.find(context);
+    if(h == heaps.end()) return;
+
+    trim(h->second, 0);
+    if(h->second.stats.slabs == 0 && h->second.views.empty() && h->second.refs.empty() && h->second.direct.empty()) heaps.erase(h);
+}
+
+// 0 turns pooling off for new buffers
+void ecl::Pool::setSlabSize(std::size_t size){
+    std::lock_guard<std::mutex> guard(lock);
+    slab_size = size;
+}
+// idle slabs beyond high are given back until low is left
+void ecl::Pool::setWatermarks(std::size_t high, std::size_t low){
+    if(low > high) throw std::runtime_error("Pool [watermarks]: low is above high");
+
+    std::lock_guard<std::mutex> guard(lock);
+    Pool::high = high;
+    Pool::low = low;
+    for(auto& h : heaps) if(h.second.stats.idle > high) trim(h.second, low);
+}
+
+ecl::Pool::Stats ecl::Pool::getStats(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto h = heaps.find(context);
+    if(h == heaps.end()) return Stats();
+
+    return h->second.stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Memory Class Definition
+///////////////////////////////////////////////////////////////////////////////
+std::map<cl_context, ecl::Memory::Resident> ecl::Memory::residents;
+ecl::Memory::Stats ecl::Memory::total;
+std::mutex ecl::Memory::lock;
+
+// stats of the context and the totals move together
+void ecl::Memory::count(Resident& r, std::size_t size, bool added){
+    for(Stats* s : {&r.stats, &total}){
+        if(added){
+            s->live += size;
+            s->buffers++;
+            s->allocations++;
+            s->peak = std::max(s->peak, s->live);
+        }
+        else{
+            s->live -= size;
+            s->buffers--;
+        }
+    }
+}
+
+void ecl::Memory::reset(Entry& entry){
+    if(entry.last != nullptr) clReleaseEvent(entry.last);
+    entry.last = nullptr;
+}
+
+// least recently used buffer that no launch is binding; it's out of the list before the
+// lock is given up, so nobody else evicts it too. Only buffers whose latest data is known
+// go: read-only or coherent ones, and none that slices or views still share
+bool ecl::Memory::evict(cl_context context, const Buffer* self){
+    Entry victim;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto r = residents.find(context);
+        if(r == residents.end()) return false;
+
+        auto& order = r->second.order;
+        auto it = order.begin();
+        for(; it != order.end(); it++){
+            if(it->pins != 0 || it->buffer == self || it->buffer->getMemory() != COPY) continue; // zero-copy memory is shared with the host
+            if((it->written || it->buffer->getAccess() != READ) && !it->buffer->isCoherent()) continue;
+            if(!Pool::isShared(context, it->mem)) break;
+        }
+        if(it == order.end()) return false;
+
+        victim = *it;
+        r->second.entries.erase(it->buffer);
+        count(r->second, it->size, false);
+        order.erase(it);
+
+        r->second.stats.evictions++;
+        r->second.stats.evicted += victim.size;
+        total.evictions++;
+        total.evicted += victim.size;
+    }
+
+    try{
+        if(victim.last != nullptr){
+            error = clWaitForEvents(1, &victim.last);
+            checkError("Memory [evict]");
+        }
+        victim.buffer->evict(context);
+    }catch(...){
+        reset(victim);
+        throw;
+    }
+    reset(victim);
+    return true;
+}
+
+// the budget is kept before allocating; a driver that's out of memory gets another try
+// after every eviction, with the idle pool slabs given back. The bytes are reserved against
+// the limit under the lock, so allocations racing on other threads can't pass it together
+cl_mem ecl::Memory::create(cl_context context, const Buffer* self, ACCESS access, std::size_t size, cl_mem_flags host, void* ptr){
+    for(;;){
+        bool over, limited;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            Resident& r = residents[context];
+            std::size_t needed = r.stats.live + r.pending + size;
+            over = r.budget != 0 && needed > r.budget;
+            limited = r.limit != 0 && needed > r.limit;
+            if(!limited) r.pending += size;
+        }
+
+        if(over || limited){
+            if(evict(context, self)){
+                if(!limited) cancel(context, size);
+                continue;
+            }
+            if(limited) throw std::runtime_error("Memory [create]: device memory limit reached");
+        }
+
+        try{
+            return Pool::create(context, access, size, host, ptr);
+        }catch(const std::runtime_error&){
+            cancel(context, size);
+            if(error != CL_MEM_OBJECT_ALLOCATION_FAILURE && error != CL_OUT_OF_RESOURCES) throw;
+            if(!evict(context, self)) throw;
+            Pool::trim(context);
+        }
+    }
+}
+// bytes reserved by create for a buffer that won't be added
+void ecl::Memory::cancel(cl_context context, std::size_t size){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r != residents.end()) r->second.pending -= std::min(r->second.pending, size);
+}
+
+void ecl::Memory::add(cl_context context, Buffer* buffer, cl_mem mem){
+    std::lock_guard<std::mutex> guard(lock);
+    Resident& r = residents[context];
+    if(r.entries.find(buffer) != r.entries.end()) return;
+
+    r.order.push_back(Entry{buffer, mem, buffer->getSize(), nullptr, 0, false});
+    r.entries.emplace(buffer, std::prev(r.order.end()));
+    r.pending -= std::min(r.pending, buffer->getSize()); // reserved by create, if it came from there
+    count(r, buffer->getSize(), true);
+}
+void ecl::Memory::drop(cl_context context, const Buffer* buffer){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    auto it = r->second.entries.find(buffer);
+    if(it != r->second.entries.end()){
+        count(r->second, it->second->size, false);
+        reset(*it->second);
+        r->second.order.erase(it->second);
+        r->second.entries.erase(it);
+    }
+}
+// moved buffers keep their place
+void ecl::Memory::rename(cl_context context, const Buffer* from, Buffer* to){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    auto it = r->second.entries.find(from);
+    if(it == r->second.entries.end()) return;
+
+    auto entry = it->second;
+    entry->buffer = to;
+    r->second.entries.erase(it);
+    r->second.entries.emplace(to, entry);
+}
+
+void ecl::Memory::use(cl_context context, const Buffer* buffer, cl_event e){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    auto it = r->second.entries.find(buffer);
+    if(it == r->second.entries.end()) return;
+
+    auto entry = it->second;
+    if(e != nullptr) clRetainEvent(e);
+    reset(*entry);
+    entry->last = e;
+
+    r->second.order.splice(r->second.order.end(), r->second.order, entry);
+}
+// copies and fills write read-only buffers too, their device data can't be dropped then
+void ecl::Memory::setWritten(cl_context context, const Buffer* buffer, bool written){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    auto it = r->second.entries.find(buffer);
+    if(it != r->second.entries.end()) it->second->written = written;
+}
+void ecl::Memory::pin(cl_context context, const Buffer* buffer){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    auto it = r->second.entries.find(buffer);
+    if(it != r->second.entries.end()) it->second->pins++;
+}
+void ecl::Memory::unpin(cl_context context, const Buffer* buffer){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    auto it = r->second.entries.find(buffer);
+    if(it != r->second.entries.end() && it->second->pins > 0) it->second->pins--;
+}
+
+// bytes of buffers the context keeps on the device before evicting, 0 evicts only when the driver fails
+void ecl::Memory::setBudget(cl_context context, std::size_t budget){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        residents[context].budget = budget;
+    }
+    for(;;){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            const Resident& r = residents[context];
+            if(r.budget == 0 || r.stats.live <= r.budget) break;
+        }
+        if(!evict(context, nullptr)) break;
+    }
+}
+std::size_t ecl::Memory::getBudget(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    return r == residents.end() ? 0 : r->second.budget;
+}
+std::size_t ecl::Memory::getResident(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    return r == residents.end() ? 0 : r->second.stats.live;
+}
+// hard cap on the bytes of the context, evicting doesn't get past it
+void ecl::Memory::setLimit(cl_context context, std::size_t limit){
+    std::lock_guard<std::mutex> guard(lock);
+    residents[context].limit = limit;
+}
+std::size_t ecl::Memory::getLimit(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    return r == residents.end() ? 0 : r->second.limit;
+}
+
+ecl::Memory::Stats ecl::Memory::getStats(cl_context context){
+    Stats result;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto r = residents.find(context);
+        if(r != residents.end()) result = r->second.stats;
+    }
+    Pool::Stats pool = Pool::getStats(context);
+    result.reserved = pool.reserved + pool.direct;
+    return result;
+}
+ecl::Memory::Stats ecl::Memory::getTotal(){
+    std::lock_guard<std::mutex> guard(lock);
+    Stats result = total;
+    for(const auto& r : residents){
+        Pool::Stats pool = Pool::getStats(r.first);
+        result.reserved += pool.reserved + pool.direct;
+    }
+    return result;
+}
+// largest buffers on the device first
+std::vector<ecl::Memory::Usage> ecl::Memory::getLargest(cl_context context, std::size_t count){
+    std::vector<Usage> result;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto r = residents.find(context);
+        if(r == residents.end()) return result;
+
+        result.reserve(r->second.order.size());
+        for(const auto& e : r->second.order) result.push_back(Usage{e.buffer, e.size, e.buffer->getAccess()});
+    }
+
+    count = std::min(count, result.size());
+    std::partial_sort(result.begin(), result.begin() + count, result.end(), [](const Usage& a, const Usage& b){ return a.size > b.size; });
+    result.resize(count);
+    return result;
+}
+void ecl::Memory::resetPeak(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r != residents.end()) r->second.stats.peak = r->second.stats.live;
+}
+// the context is gone, or new and only sharing the handle of a released one; its budget, limit and stats go with it
+void ecl::Memory::forget(cl_context context){
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = residents.find(context);
+    if(r == residents.end()) return;
+
+    for(auto& entry : r->second.order) reset(entry);
+    total.live -= r->second.stats.live;
+    total.buffers -= r->second.stats.buffers;
+    residents.erase(r);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer Class Definition
+///////////////////////////////////////////////////////////////////////////////
+void ecl::Buffer::copy(const Buffer& other) {
+	clear();
+
+	ptr = other.ptr;
+	size = other.size;
+	access = other.access;
+	memory = other.memory;
+	tracking = other.tracking;
+	coherent = other.coherent;
+	unit = other.unit;
+
+	std::lock_guard<std::mutex> guard(other.lock);
+	if (memory == COPY) for (auto& p : other.buffer) createBuffer(p.first); // zero-copy ones would alias the other host memory
 }
 void ecl::Buffer::move(Buffer& other) {
 	clear();
@@ -1008,11 +2684,46 @@ void ecl::Buffer::move(Buffer& other) {
 	ptr = other.ptr;
 	size = other.size;
 	access = other.access;
-	buffer = std::move(other.buffer);
+	memory = other.memory;
+	{
+		std::lock_guard<std::mutex> guard(other.lock);
+		for (const auto& p : other.buffer) Memory::rename(p.first, &other, this);
+		buffer = std::move(other.buffer);
+		mapped = std::move(other.mapped);
+		dirty = std::move(other.dirty);
+		tracking = other.tracking;
+		coherent = other.coherent;
+		current = std::move(other.current);
+		host = other.host;
+		source = other.source;
+		source_queue = other.source_queue;
+		pending = other.pending;
+		settled = other.settled.load();
+		fresh = other.fresh.load();
+		evicted = std::move(other.evicted);
+		segments = std::move(other.segments);
+		unit = other.unit;
+		other.buffer.clear();
+		other.mapped.clear();
+		other.dirty.clear();
+		other.tracking = false;
+		other.coherent = false;
+		other.current.clear();
+		other.host = true;
+		other.source = nullptr;
+		other.source_queue = nullptr;
+		other.pending = nullptr;
+		other.settled = true;
+		other.fresh = false;
+		other.evicted.clear();
+		other.segments.clear();
+		other.unit = 1;
+	}
 
 	other.ptr = nullptr;
 	other.size = 0;
 	other.access = READ;
+	other.memory = COPY;
 
 	other.clear();
 }
@@ -1042,6 +2753,8 @@ ecl::Buffer& ecl::Buffer::operator=(Buffer&& other) {
 }
 
 cl_mem ecl::Buffer::getBuffer(cl_context context) const{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!segments.empty()) throw std::runtime_error("Buffer [get]: segmented buffer has a device buffer for every segment");
 	return buffer.at(context);
 }
 void* ecl::Buffer::getPtr() {
@@ -1053,36 +2766,428 @@ std::size_t ecl::Buffer::getSize() const {
 ecl::ACCESS ecl::Buffer::getAccess() const {
 	return access;
 }
+ecl::MEMORY ecl::Buffer::getMemory() const {
+	return memory;
+}
 
 void ecl::Buffer::setPtr(void* ptr) {
 	this->ptr = ptr;
 }
+// with tracking on, a send uploads only the ranges marked since the previous one
+void ecl::Buffer::setTracking(bool tracking) {
+	std::lock_guard<std::mutex> guard(lock);
+	this->tracking = tracking;
+	dirty.clear();
+}
+bool ecl::Buffer::isTracking() const {
+	return tracking;
+}
+// host memory changed, by the host or by a read from the device copy of except
+void ecl::Buffer::markDirty(std::size_t offset, std::size_t size, cl_context except) {
+	if (offset + size > this->size) throw std::runtime_error("Buffer [dirty]: range is out of buffer");
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& d : dirty) if (d.first != except) d.second.emplace_back(offset, size);
+	for (auto it = current.begin(); it != current.end();) {
+		if (*it == except) it++;
+		else it = current.erase(it);
+	}
+}
+// false when the device copy isn't complete and the whole buffer has to go
+bool ecl::Buffer::takeDirty(cl_context context, std::vector<Range>& ranges) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!tracking) return false;
+
+	auto it = dirty.find(context);
+	if (it == dirty.end()) {
+		dirty.emplace(context, std::vector<Range>());
+		return false;
+	}
+
+	ranges.swap(it->second);
+	it->second.clear();
+	merge(ranges);
+	return true;
+}
+
+// with coherence on, kernels upload stale arguments themselves and host access brings
+// back what a kernel wrote; the device copies are stale after writable host access,
+// or only after touch when tracking is on too
+void ecl::Buffer::setCoherent(bool coherent) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (coherent && !segments.empty()) throw std::runtime_error("Buffer [coherent]: segmented buffers aren't coherent");
+	this->coherent = coherent;
+	current.clear();
+}
+bool ecl::Buffer::isCoherent() const {
+	return coherent;
+}
+bool ecl::Buffer::isCurrent(cl_context context) const {
+	std::lock_guard<std::mutex> guard(lock);
+	return current.find(context) != current.end();
+}
+bool ecl::Buffer::isHostCurrent() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return host;
+}
+void ecl::Buffer::markCurrent(cl_context context) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (host) {
+		current.insert(context);
+		fresh = true;
+	}
+}
+// the other device copies are stale now and their dirty ranges are no use anymore
+void ecl::Buffer::markWritten(cl_context context, cl_command_queue queue, cl_event e) {
+	std::lock_guard<std::mutex> guard(lock);
+	current.clear();
+	current.insert(context);
+	fresh = true;
+	host = false;
+	source = context;
+	setPending(queue, e);
+
+	for (auto it = dirty.begin(); it != dirty.end();) {
+		if (it->first == context) (it++)->second.clear();
+		else it = dirty.erase(it);
+	}
+}
+void ecl::Buffer::markHost(cl_event e) {
+	std::lock_guard<std::mutex> guard(lock);
+	host = true;
+	source = nullptr;
+	setPending(nullptr, e);
+}
+void ecl::Buffer::invalidate() {
+	if (!fresh) return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	current.clear();
+	fresh = false;
+}
+void ecl::Buffer::setPending(cl_command_queue queue, cl_event e) {
+	if (queue != nullptr) clRetainCommandQueue(queue);
+	if (e != nullptr) clRetainEvent(e);
+	if (source_queue != nullptr) clReleaseCommandQueue(source_queue);
+	if (pending != nullptr) clReleaseEvent(pending);
+
+	source_queue = queue;
+	pending = e;
+	settled = host && pending == nullptr;
+}
+
+// returns once host memory holds the latest data; waits run without the lock
+void ecl::Buffer::fetch() {
+	if (settled) return;
+
+	cl_command_queue queue = nullptr;
+	cl_mem mem = nullptr;
+	cl_event e;
+	cl_context context = nullptr;
+	bool arrived;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (host && pending == nullptr) return;
+
+		arrived = host;
+		e = pending;
+		clRetainEvent(e);
+		if (!arrived) {
+			context = source;
+			queue = source_queue;
+			mem = buffer.at(context);
+		}
+	}
+
+	if (arrived || (isZeroCopy(context) && getMapping(context) != nullptr)) error = clWaitForEvents(1, &e);
+	else if (isZeroCopy(context)) {
+		void* mapping = clEnqueueMapBuffer(queue, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, 1, &e, nullptr, &error);
+		if (error == CL_SUCCESS) setMapping(context, mapping);
+	}
+	else error = clEnqueueReadBuffer(queue, mem, CL_TRUE, 0, size, ptr, 1, &e, nullptr);
+	if (error != CL_SUCCESS) {
+		clReleaseEvent(e);
+		checkError("Buffer [fetch]");
+	}
+
+	// a newer write since then keeps its own pending event
+	std::lock_guard<std::mutex> guard(lock);
+	if (pending == e) {
+		host = true;
+		source = nullptr;
+		setPending(nullptr, nullptr);
+	}
+	clReleaseEvent(e);
+}
+// host side access of coherent buffers, write access without tracking makes the device copies stale
+void ecl::Buffer::checkHost(bool write) {
+	if (!coherent) return;
+
+	fetch();
+	if (write && !tracking) invalidate();
+}
+
+// overlapping and close ranges become one, then the closest ones are joined until few enough
+// are left, a slightly larger upload is cheaper than another command
+void ecl::Buffer::merge(std::vector<Range>& ranges) {
+	const std::size_t GAP = 4096;
+	const std::size_t MAX_RANGES = 16;
+	if (ranges.empty()) return;
+
+	std::sort(ranges.begin(), ranges.end());
+	std::vector<Range> result(1, ranges[0]);
+	for (std::size_t i = 1; i < ranges.size(); i++) {
+		Range& last = result.back();
+		std::size_t end = last.first + last.second;
+
+		if (ranges[i].first <= end + GAP) last.second = std::max(end, ranges[i].first + ranges[i].second) - last.first;
+		else result.push_back(ranges[i]);
+	}
+
+	if (result.size() > MAX_RANGES) {
+		std::vector<std::size_t> gaps;
+		for (std::size_t i = 1; i < result.size(); i++) gaps.push_back(result[i].first - result[i - 1].first - result[i - 1].second);
+
+		std::nth_element(gaps.begin(), gaps.begin() + (result.size() - MAX_RANGES - 1), gaps.end());
+		std::size_t limit = gaps[result.size() - MAX_RANGES - 1];
+
+		std::vector<Range> joined(1, result[0]);
+		for (std::size_t i = 1; i < result.size(); i++) {
+			Range& last = joined.back();
+			std::size_t end = last.first + last.second;
+
+			if (result[i].first - end <= limit) last.second = result[i].first + result[i].second - last.first;
+			else joined.push_back(result[i]);
+		}
+		result.swap(joined);
+	}
+
+	ranges.swap(result);
+}
+
+// host memory aligned to HOST_ALIGNMENT is shared with the device as is, otherwise the
+// driver allocates host visible memory and transfers stay copies
+void ecl::Buffer::setMemory(MEMORY memory) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!buffer.empty() || !segments.empty()) throw std::runtime_error("Buffer [memory]: unable to change memory of sent buffer");
+	this->memory = memory;
+}
+
+bool ecl::Buffer::isZeroCopy(cl_context context) const {
+	if (memory != ZERO_COPY) return false;
+
+	cl_mem_flags flags;
+	error = clGetMemObjectInfo(getBuffer(context), CL_MEM_FLAGS, sizeof(flags), &flags, nullptr);
+	checkError("Buffer [zero copy]");
+
+	return (flags & CL_MEM_USE_HOST_PTR) != 0;
+}
+void* ecl::Buffer::getMapping(cl_context context) const {
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = mapped.find(context);
+	return it == mapped.end() ? nullptr : it->second;
+}
+void ecl::Buffer::setMapping(cl_context context, void* mapping) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (mapping == nullptr) mapped.erase(context);
+	else mapped[context] = mapping;
+}
 
 bool ecl::Buffer::checkBuffer(cl_context context) const {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!segments.empty()) {
+		for (const auto& seg : segments) if (!seg->checkBuffer(context)) return false;
+		return true;
+	}
 	if (buffer.find(context) != buffer.end()) return true;
 	return false;
 }
+// allocating may evict other buffers, so it runs without the lock
 void ecl::Buffer::createBuffer(cl_context context) {
-	if (!checkBuffer(context)) {
-		buffer.emplace(context, clCreateBuffer(context, access, size, nullptr, &error));
-		checkError("Buffer [check]");
+	if (checkBuffer(context)) return;
+
+	std::size_t limit = getLimit(context);
+	if (memory == COPY && size > limit) split(limit);
+	if (isSegmented()) {
+		for (auto* seg : getSegments()) {
+			if (seg->getSize() > limit) throw std::runtime_error("Buffer [check]: segments are too large for the device");
+			seg->createBuffer(context);
+		}
+		return;
+	}
+
+	// zero-copy memory counts against the budget and the limit like the rest
+	cl_mem result;
+	if (memory == COPY) result = Memory::create(context, this, access, size);
+	else {
+		bool shared = ptr != nullptr && reinterpret_cast<std::uintptr_t>(ptr) % HOST_ALIGNMENT == 0;
+		result = Memory::create(context, this, access, size, shared ? CL_MEM_USE_HOST_PTR : CL_MEM_ALLOC_HOST_PTR, shared ? ptr : nullptr);
 	}
+
+	bool first;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		first = buffer.emplace(context, result).second;
+		if (first) evicted.erase(context);
+	}
+	if (first) {
+		Memory::add(context, this, result);
+		return;
+	}
+
+	// another thread was first
+	Memory::cancel(context, size);
+	Pool::release(context, result);
 }
 void ecl::Buffer::releaseBuffer(cl_context context) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& seg : segments) seg->releaseBuffer(context);
+
 	auto it = buffer.find(context);
 	if (it != buffer.end()) {
-		error = clReleaseMemObject(buffer.at(context));
+		cl_mem mem = it->second;
+		Memory::drop(context, this);
 		buffer.erase(it);
-
-		checkError("Buffer [clear]");
+		mapped.erase(context);
+		dirty.erase(context);
+		current.erase(context);
+		if (source == context) { // the latest data goes with it
+			host = true;
+			source = nullptr;
+			setPending(nullptr, nullptr);
+		}
+
+		Pool::release(context, mem);
 	}
 }
 
 void ecl::Buffer::clear() {
-	while(buffer.size() > 0) releaseBuffer(buffer.begin()->first);
+	std::map<cl_context, cl_mem> released;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		released.swap(buffer);
+		for (const auto& p : released) Memory::drop(p.first, this);
+		segments.clear();
+		mapped.clear();
+		dirty.clear();
+		tracking = false;
+		coherent = false;
+		evicted.clear();
+		current.clear();
+		host = true;
+		source = nullptr;
+		setPending(nullptr, nullptr);
+	}
+	for (const auto& p : released) Pool::release(p.first, p.second);
 	ptr = nullptr;
 	size = 0;
 	access = READ;
+	memory = COPY;
+}
+
+std::map<cl_context, std::size_t> ecl::Buffer::limits;
+std::mutex ecl::Buffer::limits_lock;
+
+// smallest CL_DEVICE_MAX_MEM_ALLOC_SIZE of the context devices
+std::size_t ecl::Buffer::getLimit(cl_context context) {
+	std::lock_guard<std::mutex> guard(limits_lock);
+	auto it = limits.find(context);
+	if (it != limits.end()) return it->second;
+
+	std::size_t info_size;
+	error = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, nullptr, &info_size);
+	checkError("Buffer [limit]");
+
+	std::vector<cl_device_id> devices(info_size / sizeof(cl_device_id));
+	error = clGetContextInfo(context, CL_CONTEXT_DEVICES, info_size, devices.data(), nullptr);
+	checkError("Buffer [limit]");
+
+	cl_ulong result = (cl_ulong)-1;
+	for (auto device : devices) {
+		cl_ulong bytes;
+		error = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(bytes), &bytes, nullptr);
+		checkError("Buffer [limit]");
+
+		result = std::min(result, bytes);
+	}
+
+	std::size_t limit = result > std::numeric_limits<std::size_t>::max() ? std::numeric_limits<std::size_t>::max() : std::size_t(result);
+	limits.emplace(context, limit);
+	return limit;
+}
+
+// segments hold a power of two of elements, so the segments of arrays with other element
+// sizes still line up and their boundaries keep the device offset alignment
+void ecl::Buffer::split(std::size_t limit) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!segments.empty()) return;
+	if (coherent) throw std::runtime_error("Buffer [segment]: coherent buffers can't be segmented");
+
+	std::size_t elements = 1;
+	while (elements * 2 * unit <= limit) elements *= 2;
+	if (elements * unit > limit) throw std::runtime_error("Buffer [segment]: element is larger than the device allows");
+
+	std::size_t bytes = elements * unit;
+	for (std::size_t offset = 0; offset < size; offset += bytes) {
+		segments.emplace_back(new Buffer(static_cast<char*>(ptr) + offset, std::min(bytes, size - offset), access));
+		segments.back()->unit = unit;
+	}
+}
+bool ecl::Buffer::isSegmented() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return !segments.empty();
+}
+std::vector<ecl::Buffer*> ecl::Buffer::getSegments() const {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<Buffer*> result;
+	for (const auto& seg : segments) result.push_back(seg.get());
+	return result;
+}
+std::size_t ecl::Buffer::getUnit() const {
+	return unit;
+}
+
+// bytes of the buffer as a buffer of their own in one context, sharing host and device
+// memory; a part can't cross segments
+ecl::Buffer ecl::Buffer::part(cl_context context, std::size_t offset, std::size_t size) {
+	if (offset + size > this->size) throw std::runtime_error("Buffer [part]: range is out of buffer");
+
+	Buffer result(static_cast<char*>(ptr) + offset, size, access);
+	result.unit = unit;
+	result.memory = memory;
+
+	Buffer* owner = this;
+	std::size_t origin = offset;
+	if (isSegmented()) {
+		auto parts = getSegments();
+		std::size_t bytes = parts[0]->getSize();
+		owner = parts[origin / bytes];
+		origin %= bytes;
+		if (origin + size > owner->getSize()) throw std::runtime_error("Buffer [part]: range crosses segments");
+	}
+
+	cl_mem mem = owner->getBuffer(context);
+	if (origin == 0 && size == owner->getSize()) Pool::retain(context, mem);
+	else mem = Pool::slice(context, mem, access, origin, size);
+	result.buffer.emplace(context, mem);
+
+	return result;
+}
+
+bool ecl::Buffer::isEvicted(cl_context context) const {
+	std::lock_guard<std::mutex> guard(lock);
+	return evicted.find(context) != evicted.end();
+}
+// the device copy is given up and the next launch binding the buffer uploads it again;
+// coherent buffers read it back first only when it's newer than host memory
+void ecl::Buffer::evict(cl_context context) {
+	if (!checkBuffer(context)) return;
+
+	if (coherent) fetch();
+	releaseBuffer(context);
+
+	std::lock_guard<std::mutex> guard(lock);
+	evicted.insert(context);
 }
 
 ecl::Buffer::~Buffer() {
@@ -1249,18 +3354,49 @@ ecl::var<T>::~var() {
 ///////////////////////////////////////////////////////////////////////////////
 // array Container Definition
 ///////////////////////////////////////////////////////////////////////////////
+// zero-copy arrays start on a page boundary; the original allocation is kept just before the elements
 template<typename T>
-void ecl::array<T>::copy(const array<T>& other) {
-	clear();
+T* ecl::array<T>::allocate(std::size_t count, MEMORY memory) {
+	std::size_t align = std::max(memory == ZERO_COPY ? HOST_ALIGNMENT : alignof(T), alignof(void*));
+	char* raw = static_cast<char*>(::operator new(count * sizeof(T) + align + sizeof(void*)));
 
-	Buffer::copy(other);
+	std::uintptr_t first = reinterpret_cast<std::uintptr_t>(raw + sizeof(void*));
+	T* result = reinterpret_cast<T*>((first + align - 1) / align * align);
+	reinterpret_cast<void**>(result)[-1] = raw;
 
-	arr_size = other.arr_size;
-	arr = new T[arr_size];
-	for(size_t i = 0; i < arr_size; i++) arr[i] = other.arr[i];
+	std::size_t i = 0;
+	try {
+		for (; i < count; i++) new(result + i) T;
+	}
+	catch (...) {
+		while (i > 0) result[--i].~T();
+		::operator delete(raw);
+		throw;
+	}
+	return result;
+}
+template<typename T>
+void ecl::array<T>::deallocate(T* arr, std::size_t count) {
+	if (arr == nullptr) return;
+
+	for (std::size_t i = 0; i < count; i++) arr[i].~T();
+	::operator delete(reinterpret_cast<void**>(arr)[-1]);
+}
+
+template<typename T>
+void ecl::array<T>::copy(const array<T>& other) {
+	clear();
+	const_cast<array<T>&>(other).checkHost(false);
+
+	Buffer::copy(other);
+
+	arr_size = other.arr_size;
+	arr = allocate(arr_size, other.memory);
+	for(size_t i = 0; i < arr_size; i++) arr[i] = other.arr[i];
 
 	setPtr(arr);
 	manage = AUTO;
+	aligned = true;
 }
 template<typename T>
 void ecl::array<T>::move(array<T>& other) {
@@ -1271,6 +3407,7 @@ void ecl::array<T>::move(array<T>& other) {
 	arr_size = other.arr_size;
 	setPtr(arr);
 	manage = other.manage;
+	aligned = other.aligned;
     other.manage = MANUALLY;
 
 	other.arr = nullptr;
@@ -1282,19 +3419,24 @@ void ecl::array<T>::move(array<T>& other) {
 
 template<typename T>
 ecl::array<T>::array() : Buffer(nullptr, 0, READ_WRITE) {
+	unit = sizeof(T);
 	arr = nullptr;
 	arr_size = 0;
 	manage = MANUALLY;
 }
 template<typename T>
-ecl::array<T>::array(std::size_t size, ACCESS access) : Buffer(nullptr, size * sizeof(T), access) {
-	arr = new T[size];
+ecl::array<T>::array(std::size_t size, ACCESS access, MEMORY memory) : Buffer(nullptr, size * sizeof(T), access) {
+	unit = sizeof(T);
+	this->memory = memory;
+	arr = allocate(size, memory);
 	setPtr(arr);
 	arr_size = size;
 	manage = AUTO;
+	aligned = true;
 }
 template<typename T>
 ecl::array<T>::array(const T* arr, std::size_t size, FREE manage) : Buffer(nullptr, size * sizeof(T), READ){
+	unit = sizeof(T);
 	this->arr = const_cast<T*>(arr);
 	setPtr(this->arr);
 	arr_size = size;
@@ -1302,6 +3444,7 @@ ecl::array<T>::array(const T* arr, std::size_t size, FREE manage) : Buffer(nullp
 }
 template<typename T>
 ecl::array<T>::array(T* arr, std::size_t size, ACCESS access, FREE manage) : Buffer(nullptr, size * sizeof(T), access) {
+	unit = sizeof(T);
 	this->arr = arr;
 	setPtr(this->arr);
 	arr_size = size;
@@ -1330,10 +3473,13 @@ ecl::array<T>& ecl::array<T>::operator=(array<T>&& other) {
 
 template<typename T>
 T* ecl::array<T>::getArray() {
+	checkHost(true);
 	return arr;
 }
+// host memory is part of the value, bringing it up to date doesn't change the array
 template<typename T>
 const T* ecl::array<T>::getConstArray() const {
+	const_cast<array<T>*>(this)->checkHost(false);
 	return arr;
 }
 template<typename T>
@@ -1348,43 +3494,247 @@ std::size_t ecl::array<T>::getArraySize() const {
 template<typename T>
 void ecl::array<T>::view(array<T>& other) {
 	clear();
-	buffer = other.buffer;
+	{
+		std::lock_guard<std::mutex> guard(other.lock);
+		for (const auto& p : other.buffer) {
+			Pool::retain(p.first, p.second);
+			buffer.emplace(p.first, p.second);
+		}
+	}
 	ptr = other.ptr;
 	size = other.size;
 	access = other.access;
+	memory = other.memory;
+	unit = other.unit;
 
 	arr = other.arr;
 	arr_size = other.arr_size;
 	manage = MANUALLY;
 }
 
+// window of the array sharing its host and device memory, for every context the array was
+// sent to; the device requires offsets aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN
+template<typename T>
+ecl::array<T> ecl::array<T>::slice(std::size_t offset, std::size_t count) {
+	if (offset + count > arr_size) throw std::runtime_error("array [slice]: range is out of array");
+
+	array<T> result(arr + offset, count, access, MANUALLY);
+	result.memory = memory;
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (const auto& p : buffer) result.buffer.emplace(p.first, Pool::slice(p.first, p.second, access, offset * sizeof(T), count * sizeof(T)));
+
+	return result;
+}
+
+// operator[] can't tell reads from writes, so tracked arrays are told what changed
+template<typename T>
+void ecl::array<T>::touch(std::size_t index, std::size_t count) {
+	markDirty(index * sizeof(T), count * sizeof(T));
+}
+template<typename T>
+void ecl::array<T>::set(std::size_t index, const T& value) {
+	checkHost(true);
+	arr[index] = value;
+	if (tracking) touch(index);
+}
+
 template<typename T>
 T& ecl::array<T>::operator[](std::size_t index) {
+	checkHost(true);
 	return arr[index];
 }
 template<typename T>
 ecl::array<T>::operator T*() {
+	checkHost(true);
 	return arr;
 }
 template<typename T>
 ecl::array<T>::operator const T*() const {
+	const_cast<array<T>*>(this)->checkHost(false);
 	return arr;
 }
 
 template<typename T>
 void ecl::array<T>::clear() {
 	Buffer::clear();
-	if (manage == AUTO) delete[] arr;
+	if (manage == AUTO) {
+		if (aligned) deallocate(arr, arr_size);
+		else delete[] arr;
+	}
 
 	arr = nullptr;
 	arr_size = 0;
 	manage = MANUALLY;
+	aligned = false;
 }
 template<typename T>
 ecl::array<T>::~array() {
 	clear();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Argument Class Definition
+///////////////////////////////////////////////////////////////////////////////
+ecl::Argument::Argument(const Buffer* buffer){
+    this->buffer = buffer;
+}
+ecl::Argument::Argument(const void* data, std::size_t size){
+    const unsigned char* bytes = (const unsigned char*)data;
+    value.assign(bytes, bytes + size);
+}
+ecl::Argument::Argument(std::size_t local){
+    if(local == 0) throw std::runtime_error("Argument [init]: local memory size must be positive");
+    this->local = local;
+}
+
+const ecl::Buffer* ecl::Argument::getBuffer() const{
+    return buffer;
+}
+bool ecl::Argument::isValue() const{
+    return buffer == nullptr && local == 0;
+}
+bool ecl::Argument::isLocal() const{
+    return local != 0;
+}
+bool ecl::Argument::isPiecewise() const{
+    return piecewise;
+}
+
+void ecl::Argument::bind(cl_kernel kernel, std::size_t i, cl_context context, const std::string& where) const{
+    if(buffer != nullptr){
+        if(!buffer->checkBuffer(context)) throw std::runtime_error(where + ": buffer wasn't sent to computer");
+
+        cl_mem buf = buffer->getBuffer(context);
+        error = clSetKernelArg(kernel, i, sizeof(cl_mem), &buf);
+    }
+    else if(local != 0) error = clSetKernelArg(kernel, i, local, nullptr);
+    else error = clSetKernelArg(kernel, i, value.size(), value.data());
+
+    checkError(where);
+}
+
+template<typename T>
+ecl::Argument ecl::value(const T& v){
+    static_assert(std::is_trivially_copyable<T>::value, "kernel arguments are passed by bytes");
+    return Argument(&v, sizeof(T));
+}
+template<typename T>
+ecl::Argument ecl::local(std::size_t count){
+    return Argument(count * sizeof(T));
+}
+// an array that isn't segmented itself but has one element per work-item of a range with segmented arguments
+ecl::Argument ecl::piecewise(const Buffer* buffer){
+    Argument result(buffer);
+    result.piecewise = true;
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Event Class Definition
+///////////////////////////////////////////////////////////////////////////////
+void ecl::Event::copy(const Event& other){
+    clear();
+    event = other.event;
+    if(event != nullptr){
+        error = clRetainEvent(event);
+        checkError("Event [copy]");
+    }
+}
+void ecl::Event::move(Event& other){
+    clear();
+    event = other.event;
+    other.event = nullptr;
+}
+
+ecl::Event::Event(cl_event event){
+    this->event = event;
+}
+
+ecl::Event::Event(const Event& other){
+    copy(other);
+}
+ecl::Event& ecl::Event::operator=(const Event& other){
+    if(this != &other) copy(other);
+    return *this;
+}
+
+ecl::Event::Event(Event&& other){
+    move(other);
+}
+ecl::Event& ecl::Event::operator=(Event&& other){
+    if(this != &other) move(other);
+    return *this;
+}
+
+cl_event ecl::Event::getEvent() const{
+    return event;
+}
+cl_int ecl::Event::getStatus() const{
+    if(event == nullptr) return CL_COMPLETE;
+
+    cl_int status;
+    error = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+    checkError("Event [get status]");
+
+    return status;
+}
+bool ecl::Event::isComplete() const{
+    cl_int status = getStatus();
+    if(status < 0){
+        error = status;
+        checkError("Event [get status]");
+    }
+    return status == CL_COMPLETE;
+}
+
+void ecl::Event::await() const{
+    if(event == nullptr) return;
+
+    error = clWaitForEvents(1, &event);
+    checkError("Event [await]");
+}
+void ecl::Event::await(const std::vector<Event>& events){
+    auto wait_list = getWaitList(events);
+    if(wait_list.empty()) return;
+
+    error = clWaitForEvents(wait_list.size(), wait_list.empty() ? nullptr : wait_list.data());
+    checkError("Event [await]");
+}
+
+// callback runs on a driver thread with CL_COMPLETE or a negative error status
+void ecl::Event::then(const std::function<void(cl_int)>& callback){
+    if(event == nullptr){
+        callback(CL_COMPLETE);
+        return;
+    }
+
+    auto* f = new std::function<void(cl_int)>(callback);
+    error = clSetEventCallback(event, CL_COMPLETE, notify, f);
+    if(error != 0) delete f;
+    checkError("Event [then]");
+}
+void CL_CALLBACK ecl::Event::notify(cl_event, cl_int status, void* data){
+    auto* f = (std::function<void(cl_int)>*)data;
+    (*f)(status);
+    delete f;
+}
+
+std::vector<cl_event> ecl::Event::getWaitList(const std::vector<Event>& events){
+    std::vector<cl_event> result;
+    result.reserve(events.size());
+    for(const auto& e : events) if(e.event != nullptr) result.push_back(e.event);
+    return result;
+}
+
+void ecl::Event::clear(){
+    if(event != nullptr) clReleaseEvent(event);
+    event = nullptr;
+}
+ecl::Event::~Event(){
+    clear();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Computer Class Definition
 ///////////////////////////////////////////////////////////////////////////////
@@ -1395,23 +3745,120 @@ void ecl::Computer::move(ecl::Computer& other) {
 	queue = other.queue;
 	context = other.context;
 	name = std::move(other.name);
+	lanes = std::move(other.lanes);
+	transfer = other.transfer;
+	next_lane = other.next_lane;
+	hazards = std::move(other.hazards);
+	tracked = other.tracked;
+	{
+		std::lock_guard<std::mutex> guard(other.staging_lock);
+		staging = std::move(other.staging);
+		other.staging.clear();
+	}
+	staging_size = other.staging_size;
+	staging_count = other.staging_count;
+	counters = std::move(other.counters);
+	max_group_size = other.max_group_size;
+	max_item_sizes = std::move(other.max_item_sizes);
+	local_memory = other.local_memory;
+	recording = other.recording;
+	if (recording != nullptr) recording->recorder = this;
 
 	other.device = nullptr;
 	other.queue = nullptr;
 	other.context = nullptr;
+	other.lanes.clear();
+	other.transfer = nullptr;
+	other.recording = nullptr;
 
 	other.clear();
 }
 
-ecl::Computer::Computer(std::size_t i, const Platform& platform, DEVICE dev){
+ecl::Computer::Computer(std::size_t i, const Platform& platform, DEVICE dev) : Computer(i, platform, dev, 0){
+}
+// with lanes > 0 transfers get a queue of their own and kernels alternate between
+// that many compute queues, dependencies between them follow the buffers they touch;
+// 0 keeps a single in-order queue for everything
+ecl::Computer::Computer(std::size_t i, const Platform& platform, DEVICE dev, std::size_t count){
     device = platform.getDevice(i, dev);
     name = platform.getDeviceInfo(i, dev, CL_DEVICE_NAME);
 
     context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &error);
     checkError("Computer [init]");
+    Memory::forget(context);
+
+    hazards = std::make_shared<Hazards>();
+    tracked = count > 0;
+    init(count);
+}
+ecl::Computer::Computer(std::size_t i, const Platform& platform, DEVICE dev, cl_context context, const std::shared_ptr<Hazards>& hazards, std::size_t count){
+    device = platform.getDevice(i, dev);
+    name = platform.getDeviceInfo(i, dev, CL_DEVICE_NAME);
+
+    error = clRetainContext(context);
+    checkError("Computer [init]");
+    this->context = context;
+
+    this->hazards = hazards;
+    tracked = true;
+    init(count);
+}
+
+// one context for every device of the type, so programs are built once for all of them
+// and buffers move between devices without a round trip through the host
+std::vector<ecl::Computer> ecl::Computer::shared(const Platform& platform, DEVICE dev, std::size_t count){
+    const auto& devices = platform.getDevicesVector(dev);
+    if(devices.empty()) throw std::runtime_error("Computer [shared]: no devices");
+
+    cl_context context = clCreateContext(nullptr, devices.size(), devices.data(), nullptr, nullptr, &error);
+    checkError("Computer [shared]");
+    Memory::forget(context);
+
+    auto hazards = std::make_shared<Hazards>();
+    std::vector<Computer> result;
+    result.reserve(devices.size());
+
+    try{
+        for(std::size_t i = 0; i < devices.size(); i++) result.push_back(Computer(i, platform, dev, context, hazards, count));
+    }catch(...){
+        clReleaseContext(context);
+        throw;
+    }
+    clReleaseContext(context); // every computer holds its own reference
+
+    return result;
+}
+
+void ecl::Computer::init(std::size_t count){
+    counters = std::make_shared<Counters>();
 
     queue = clCreateCommandQueue(context, device, 0, &error);
     checkError("Computer [init]");
+    lanes.push_back(queue);
+    transfer = queue;
+
+    if(count > 0){
+        for(std::size_t l = 1; l < count; l++){
+            lanes.push_back(clCreateCommandQueue(context, device, 0, &error));
+            checkError("Computer [init]");
+        }
+        transfer = clCreateCommandQueue(context, device, 0, &error);
+        checkError("Computer [init]");
+    }
+
+    cl_uint dims;
+    error = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(dims), &dims, nullptr);
+    checkError("Computer [init]");
+
+    max_item_sizes.resize(dims);
+    error = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, dims * sizeof(std::size_t), max_item_sizes.data(), nullptr);
+    checkError("Computer [init]");
+
+    error = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, nullptr);
+    checkError("Computer [init]");
+
+    error = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory), &local_memory, nullptr);
+    checkError("Computer [init]");
 }
 
 ecl::Computer::Computer(Computer&& other) {
@@ -1422,7 +3869,7 @@ ecl::Computer& ecl::Computer::operator=(Computer& other) {
 	return *this;
 }
 
-void ecl::Computer::grid(const Frame& frame, const std::vector<std::size_t>& global_work_size, const std::vector<std::size_t>& local_work_size, EXEC sync){
+ecl::Kernel::Instance ecl::Computer::bindFrame(const Frame& frame, const std::string& where){
     auto& prog = frame.prog;
     auto& kern = frame.kern;
     const auto& args = frame.args;
@@ -1431,82 +3878,594 @@ void ecl::Computer::grid(const Frame& frame, const std::vector<std::size_t>& glo
     cl_program prog_program = prog.getProgram(context);
     
     kern.checkKernel(prog_program);
-    cl_kernel kern_kernel = kern.getKernel(prog_program);
+    Kernel::Instance kern_kernel(kern, prog_program);
 
+    // arguments already bound can't be evicted to make room for the next ones
     std::size_t count = args.size();
-    for (std::size_t i(0); i < count; i++) {
-        const Buffer* curr = args.at(i);
-        bool sended = curr->checkBuffer(context);
-        if(!sended) throw std::runtime_error("Computer [grid]: buffer wasn't sent to computer");
+    std::size_t pinned = 0;
+    try{
+        for (; pinned < count; pinned++){
+            Buffer* buf = const_cast<Buffer*>(args[pinned].getBuffer());
+            if(buf != nullptr){
+                restore(*buf);
+                if(buf->isCoherent() && !buf->isCurrent(context)) send(*buf, ASYNC); // stale coherent argument
+                Memory::pin(context, buf);
+            }
+            args[pinned].bind(kern_kernel, pinned, context, where);
+        }
+    }catch(...){
+        for (std::size_t i(0); i < pinned; i++) if(args[i].getBuffer() != nullptr) Memory::unpin(context, args[i].getBuffer());
+        throw;
+    }
+    for (std::size_t i(0); i < count; i++) if(args[i].getBuffer() != nullptr) Memory::unpin(context, args[i].getBuffer());
+
+    return kern_kernel;
+}
 
-        cl_mem buf = curr->getBuffer(context);
-        error = clSetKernelArg(kern_kernel, i, sizeof(cl_mem), &buf);
-        checkError("Computer [grid]");
+ecl::Event ecl::Computer::grid(const Frame& frame, const std::vector<std::size_t>& global_work_size, const std::vector<std::size_t>& local_work_size, EXEC sync, const std::vector<Event>& wait){
+    if(recording != nullptr){
+        recording->grid(*this, frame, global_work_size, local_work_size);
+        return Event();
+    }
+    if(isSplit(frame)) return split(frame, global_work_size, [&](const Frame& step, const std::vector<std::size_t>& size, const std::vector<Event>& deps){
+        return grid(step, size, local_work_size, ASYNC, deps);
+    }, sync, wait, "Computer [grid]", local_work_size.empty() ? 1 : local_work_size[0]);
+
+    auto kern_kernel = bindFrame(frame, "Computer [grid]");
+    return launch(frame.args, kern_kernel, global_work_size, local_work_size.data(), sync, wait, "Computer [grid]");
+}
+ecl::Event ecl::Computer::grid(const Frame& frame, const std::vector<std::size_t>& global_work_size, EXEC sync, const std::vector<Event>& wait){
+    if(recording != nullptr) return grid(frame, global_work_size, std::vector<std::size_t>(), sync, wait);
+    if(isSplit(frame)) return split(frame, global_work_size, [&](const Frame& step, const std::vector<std::size_t>& size, const std::vector<Event>& deps){
+        return grid(step, size, ASYNC, deps);
+    }, sync, wait, "Computer [grid]", 1);
+
+    auto kern_kernel = bindFrame(frame, "Computer [grid]");
+    return launch(frame.args, kern_kernel, global_work_size, nullptr, sync, wait, "Computer [grid]");
+}
+// PAD rounds the range up and passes the true sizes as trailing ulong arguments,
+// so the kernel has to skip work-items beyond them
+ecl::Event ecl::Computer::grid(const Frame& frame, const std::vector<std::size_t>& global_work_size, LOCAL mode, EXEC sync, const std::vector<Event>& wait){
+    if(recording != nullptr){
+        if(mode == PAD) throw std::runtime_error("Computer [grid]: padded ranges can't be recorded");
+        return grid(frame, global_work_size, getLocalSize(frame, global_work_size, mode), sync, wait);
     }
+    if(isSplit(frame)) return split(frame, global_work_size, [&](const Frame& step, const std::vector<std::size_t>& size, const std::vector<Event>& deps){
+        return grid(step, size, mode, ASYNC, deps);
+    }, sync, wait, "Computer [grid]", 1);
 
-    error = clEnqueueNDRangeKernel(queue, kern_kernel, global_work_size.size(), nullptr, global_work_size.data(), local_work_size.data(), 0, nullptr, nullptr);
-    checkError("Computer [grid]");
-    
-    if(sync == SYNC) await();
+    auto kern_kernel = bindFrame(frame, "Computer [grid]");
+
+    std::vector<std::size_t> local_work_size = getLocalSize(frame, global_work_size, mode);
+    std::vector<std::size_t> padded_work_size = global_work_size;
+
+    if(mode == PAD){
+        for(std::size_t d = 0; d < global_work_size.size(); d++){
+            padded_work_size[d] = (global_work_size[d] + local_work_size[d] - 1) / local_work_size[d] * local_work_size[d];
+
+            cl_ulong bound = global_work_size[d];
+            error = clSetKernelArg(kern_kernel, frame.args.size() + d, sizeof(bound), &bound);
+            checkError("Computer [grid]");
+        }
+    }
+
+    return launch(frame.args, kern_kernel, padded_work_size, local_work_size.data(), sync, wait, "Computer [grid]");
 }
-void ecl::Computer::grid(const Frame& frame, const std::vector<std::size_t>& global_work_size, EXEC sync){
-    auto& prog = frame.prog;
-    auto& kern = frame.kern;
-    const auto& args = frame.args;
-    
-    prog.checkProgram(context, device);
-    cl_program prog_program = prog.getProgram(context);
-    
-    kern.checkKernel(prog_program);
-    cl_kernel kern_kernel = kern.getKernel(prog_program);
+ecl::Event ecl::Computer::task(const Frame& frame, EXEC sync, const std::vector<Event>& wait){
+    if(recording != nullptr){
+        recording->grid(*this, frame, {}, {});
+        return Event();
+    }
+    auto kern_kernel = bindFrame(frame, "Computer [task]");
+    return launch(frame.args, kern_kernel, {}, nullptr, sync, wait, "Computer [task]");
+}
+
+std::vector<std::size_t> ecl::Computer::getLocalSize(const Frame& frame, const std::vector<std::size_t>& global_work_size, LOCAL mode){
+    const std::size_t GROUP_TARGET = 256; // enough work-items to hide latency on most devices
+
+    std::size_t dims = global_work_size.size();
+    if(dims == 0 || dims > max_item_sizes.size()) throw std::runtime_error("Computer [local size]: invalid work dimension");
+
+    if(mode == TUNE){
+        std::string key = getTuningKey(frame, global_work_size);
+        {
+            std::lock_guard<std::mutex> guard(tuning_lock);
+            auto it = tuning.find(key);
+            if(it != tuning.end() && it->second.size() == dims){
+                // sizes of one class may differ, the stored shape has to divide this one too
+                bool divides = true;
+                for(std::size_t d = 0; d < dims; d++) divides &= global_work_size[d] % it->second[d] == 0;
+                if(divides) return it->second;
+            }
+        }
+        return tune(frame, global_work_size);
+    }
 
-    std::size_t count = args.size();
-    for (std::size_t i(0); i < count; i++) {
-        const Buffer* curr = args.at(i);
-        bool sended = curr->checkBuffer(context);
-        if(!sended) throw std::runtime_error("Computer [grid]: buffer wasn't sent to computer");
+    frame.prog.checkProgram(context, device);
+    cl_program prog = frame.prog.getProgram(context);
+    frame.kern.checkKernel(prog);
+    Kernel::Info info = frame.kern.getInfo(prog, device);
+
+    if(info.local_memory > local_memory) throw std::runtime_error("Computer [local size]: kernel exceeds device local memory");
+
+    std::vector<std::size_t> result(dims, 1);
 
-        cl_mem buf = curr->getBuffer(context);
-        error = clSetKernelArg(kern_kernel, i, sizeof(cl_mem), &buf);
-        checkError("Computer [grid]");
+    // reqd_work_group_size leaves no choice
+    if(info.compile_work_group_size[0] != 0){
+        for(std::size_t d = 0; d < dims; d++){
+            result[d] = info.compile_work_group_size[d];
+            if(mode == FIT && global_work_size[d] % result[d] != 0)
+                throw std::runtime_error("Computer [local size]: global size isn't divisible by required work-group size");
+        }
+        return result;
     }
 
-    error = clEnqueueNDRangeKernel(queue, kern_kernel, global_work_size.size(), nullptr, global_work_size.data(), nullptr, 0, nullptr, nullptr);
-    checkError("Computer [grid]");
-    
-    if(sync == SYNC) await();
+    std::size_t limit = std::min(info.work_group_size, max_group_size);
+    std::size_t target = std::min(limit, std::max(GROUP_TARGET, info.preferred_multiple));
+
+    auto fits = [&](std::size_t d, std::size_t size){
+        if(size > max_item_sizes[d]) return false;
+        if(mode == FIT) return global_work_size[d] % size == 0;
+        return size < global_work_size[d] * 2; // don't pad a dimension past the next power of two
+    };
+
+    // grow dimension 0 to the preferred multiple first, then double dimensions in turn
+    std::size_t total = 1;
+    while(result[0] < info.preferred_multiple && total * 2 <= target && fits(0, result[0] * 2)){
+        result[0] *= 2;
+        total *= 2;
+    }
+
+    bool grown = true;
+    while(grown){
+        grown = false;
+        for(std::size_t d = 0; d < dims; d++){
+            if(total * 2 <= target && fits(d, result[d] * 2)){
+                result[d] *= 2;
+                total *= 2;
+                grown = true;
+            }
+        }
+    }
+
+    // odd sizes: fall back to the largest divisor that fits
+    if(mode == FIT && total < target && result[0] < global_work_size[0]){
+        std::size_t others = total / result[0];
+        for(std::size_t size = std::min(target / others, max_item_sizes[0]); size > result[0]; size--){
+            if(global_work_size[0] % size == 0){
+                result[0] = size;
+                break;
+            }
+        }
+    }
+
+    return result;
 }
-void ecl::Computer::task(const Frame& frame, EXEC sync){
-    auto& prog = frame.prog;
-    auto& kern = frame.kern;
-    const auto& args = frame.args;
-    
-    prog.checkProgram(context, device);
-    cl_program prog_program = prog.getProgram(context);
-    
-    kern.checkKernel(prog_program);
-    cl_kernel kern_kernel = kern.getKernel(prog_program);
 
-    std::size_t count = args.size();
-    for (std::size_t i(0); i < count; i++) {
-        const Buffer* curr = args.at(i);
-        bool sended = curr->checkBuffer(context);
-        if(!sended) throw std::runtime_error("Computer [task]: buffer wasn't sent to computer");
+ecl::Plan ecl::Computer::prepare(const Frame& frame){
+    return Plan(*this, frame);
+}
+
+std::map<std::string, std::vector<std::size_t>> ecl::Computer::tuning;
+std::string ecl::Computer::tuning_file;
+std::mutex ecl::Computer::tuning_lock;
+
+// size class is the power of two bucket of every dimension
+std::string ecl::Computer::getTuningKey(const Frame& frame, const std::vector<std::size_t>& global_work_size) const{
+    std::string size_class;
+    for(auto g : global_work_size){
+        std::size_t bucket = 0;
+        while(((std::size_t)1 << bucket) < g) bucket++;
+        size_class += (size_class.empty() ? "" : "x") + std::to_string(bucket);
+    }
+    char program[17];
+    std::snprintf(program, sizeof(program), "%016llx", (unsigned long long)frame.prog.getHash());
+    return name + "\t" + program + "\t" + frame.kern.getName() + "\t" + frame.prog.getOptions() + "\t" + size_class;
+}
+
+// candidates run against copies of the written arguments, so the real data is launched once
+std::vector<std::size_t> ecl::Computer::tune(const Frame& frame, const std::vector<std::size_t>& global_work_size){
+    const std::size_t RUNS = 3;
+
+    std::size_t dims = global_work_size.size();
+    std::vector<std::size_t> best = getLocalSize(frame, global_work_size, FIT);
+
+    cl_program prog = frame.prog.getProgram(context);
+    Kernel::Info info = frame.kern.getInfo(prog, device);
+    if(info.compile_work_group_size[0] != 0) return best;
+
+    std::size_t limit = std::min(info.work_group_size, max_group_size);
+
+    // every power of two shape that divides the range
+    std::vector<std::vector<std::size_t>> candidates(1, std::vector<std::size_t>());
+    for(std::size_t d = 0; d < dims; d++){
+        std::vector<std::vector<std::size_t>> next;
+        for(const auto& c : candidates){
+            std::size_t total = 1;
+            for(auto l : c) total *= l;
+
+            for(std::size_t l = 1; l <= max_item_sizes[d] && total * l <= limit; l *= 2){
+                if(global_work_size[d] % l != 0) break;
+                next.push_back(c);
+                next.back().push_back(l);
+            }
+        }
+        candidates = std::move(next);
+    }
+    candidates.push_back(best);
+
+    auto kern_kernel = bindFrame(frame, "Computer [tune]");
+
+    // the profiling queue doesn't see pending commands, only the ones on the arguments are waited for
+    if(isTracked()){
+        std::vector<Event> deps;
+        {
+            std::lock_guard<std::mutex> guard(hazards->lock);
+            for(const auto& a : frame.args) if(a.getBuffer() != nullptr) depend(a.getBuffer()->getBuffer(context), false, deps);
+        }
+        auto wait_list = Event::getWaitList(deps);
+        if(!wait_list.empty()){
+            error = clWaitForEvents(wait_list.size(), wait_list.data());
+            checkError("Computer [tune]");
+        }
+    }
+    else{
+        error = clFinish(queue); // the only queue
+        checkError("Computer [tune]");
+    }
 
-        cl_mem buf = curr->getBuffer(context);
-        error = clSetKernelArg(kern_kernel, i, sizeof(cl_mem), &buf);
-        checkError("Computer [task]");
+    cl_command_queue profiler = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &error);
+    checkError("Computer [tune]");
+
+    // scratch allocations mustn't evict the arguments already bound
+    for(const auto& a : frame.args) if(a.getBuffer() != nullptr) Memory::pin(context, a.getBuffer());
+    auto unpin = [&](){
+        for(const auto& a : frame.args) if(a.getBuffer() != nullptr) Memory::unpin(context, a.getBuffer());
+    };
+
+    std::vector<std::unique_ptr<Buffer>> scratch; // in the budget and the limit like any buffer
+    try{
+        for(std::size_t i = 0; i < frame.args.size(); i++){
+            const Buffer* arg = frame.args[i].getBuffer();
+            if(arg == nullptr || arg->getAccess() == READ) continue;
+
+            scratch.emplace_back(new Buffer(nullptr, arg->getSize(), arg->getAccess()));
+            scratch.back()->createBuffer(context);
+            cl_mem copy = scratch.back()->getBuffer(context);
+
+            error = clEnqueueCopyBuffer(profiler, arg->getBuffer(context), copy, 0, 0, arg->getSize(), 0, nullptr, nullptr);
+            checkError("Computer [tune]");
+
+            error = clSetKernelArg(kern_kernel, i, sizeof(cl_mem), &copy);
+            checkError("Computer [tune]");
+        }
+
+        cl_ulong best_time = (cl_ulong)-1;
+        for(const auto& c : candidates){
+            cl_ulong time = (cl_ulong)-1;
+            for(std::size_t r = 0; r <= RUNS; r++){
+                cl_event e;
+                error = clEnqueueNDRangeKernel(profiler, kern_kernel, dims, nullptr, global_work_size.data(), c.data(), 0, nullptr, &e);
+                if(error != 0) break; // shape rejected by the driver
+
+                cl_ulong start = 0, end = 0;
+                error = clWaitForEvents(1, &e);
+                if(error == 0) error = clGetEventProfilingInfo(e, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+                if(error == 0) error = clGetEventProfilingInfo(e, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+                clReleaseEvent(e);
+                checkError("Computer [tune]");
+
+                if(r > 0) time = std::min(time, end - start); // first run is a warm-up
+            }
+            if(time < best_time){
+                best_time = time;
+                best = c;
+            }
+        }
+    }catch(...){
+        clFinish(profiler);
+        clReleaseCommandQueue(profiler);
+        unpin();
+        throw;
     }
 
-    error = clEnqueueTask(queue, kern_kernel, 0, nullptr, nullptr);
-    checkError("Computer [task]");
+    clFinish(profiler); // scratch buffers go once the last copy into them is done
+    clReleaseCommandQueue(profiler);
+    scratch.clear();
+    unpin();
 
-    if(sync == SYNC) await();
+    {
+        std::lock_guard<std::mutex> guard(tuning_lock);
+        tuning[getTuningKey(frame, global_work_size)] = best;
+    }
+    saveTuning();
+
+    return best;
+}
+
+// line layout: device, program hash, kernel, options and size class separated by tabs, then the local sizes
+// malformed lines are skipped, the database is best effort
+void ecl::Computer::setTuning(const std::string& filename){
+    std::lock_guard<std::mutex> guard(tuning_lock);
+    tuning_file = filename;
+    tuning.clear();
+
+    std::ifstream f(filename);
+    std::string line;
+    while(std::getline(f, line)){
+        std::size_t split = line.rfind('\t');
+        if(split == std::string::npos) continue;
+
+        std::vector<std::size_t> sizes;
+        bool valid = true;
+        std::size_t begin = split + 1;
+        while(valid && begin < line.size()){
+            std::size_t end = line.find(' ', begin);
+            if(end == std::string::npos) end = line.size();
+            std::string token = line.substr(begin, end - begin);
+
+            std::size_t used = 0;
+            unsigned long value = 0;
+            try{
+                value = std::stoul(token, &used);
+            }catch(const std::exception&){
+                used = 0;
+            }
+            valid = used != 0 && used == token.size() && token[0] != '-' && value != 0;
+            sizes.push_back(value);
+            begin = end + 1;
+        }
+        if(valid && !sizes.empty()) tuning[line.substr(0, split)] = sizes;
+    }
+}
+
+void ecl::Computer::saveTuning(){
+    std::lock_guard<std::mutex> guard(tuning_lock);
+    if(tuning_file.empty()) return;
+
+    std::string temp = tuning_file + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    std::ofstream f(temp, std::ios::trunc);
+    if(!f.is_open()) return; // database is best effort
+
+    for(const auto& t : tuning){
+        f << t.first << '\t';
+        for(std::size_t d = 0; d < t.second.size(); d++) f << (d == 0 ? "" : " ") << t.second[d];
+        f << '\n';
+    }
+    f.close();
+
+    if(!f || std::rename(temp.c_str(), tuning_file.c_str()) != 0) std::remove(temp.c_str());
+}
+
+void ecl::Computer::retune(){
+    {
+        std::lock_guard<std::mutex> guard(tuning_lock);
+        tuning.clear();
+    }
+    saveTuning();
 }
 
 void ecl::Computer::await(){
-    error = clFinish(queue);
-    checkError("Computer [await]");
+    if(transfer != queue){
+        error = clFinish(transfer);
+        checkError("Computer [await]");
+    }
+    for(auto q : lanes){
+        error = clFinish(q);
+        checkError("Computer [await]");
+    }
+    if(!tracked) return;
+
+    // other computers of a shared context may still have commands in flight
+    std::lock_guard<std::mutex> guard(hazards->lock);
+    auto& table = hazards->table;
+    for(auto it = table.begin(); it != table.end();){
+        bool done = it->second.write.isComplete();
+        for(const auto& r : it->second.reads) done = done && r.isComplete();
+
+        if(done) it = table.erase(it);
+        else it++;
+    }
+}
+
+bool ecl::Computer::isTracked() const{
+    return tracked;
+}
+
+// read after write, write after read and write after write need an event between lanes
+void ecl::Computer::depend(cl_mem mem, bool write, std::vector<Event>& wait){
+    mem = Pool::getOwner(context, mem); // slices wait for their whole array
+    auto it = hazards->table.find(mem);
+    if(it == hazards->table.end()) return;
+
+    wait.push_back(it->second.write);
+    if(write) wait.insert(wait.end(), it->second.reads.begin(), it->second.reads.end());
+}
+void ecl::Computer::track(cl_mem mem, bool write, const Event& e){
+    mem = Pool::getOwner(context, mem);
+    Pool::use(context, mem, e.getEvent()); // released memory isn't handed out again before the other lanes are done
+    auto& h = hazards->table[mem];
+    if(write){
+        h.write = e;
+        h.reads.clear();
+    }
+    else{
+        const std::size_t PRUNE = 16;
+        if(h.reads.size() >= PRUNE){
+            std::vector<Event> pending;
+            for(auto& r : h.reads) if(r.getStatus() > CL_COMPLETE) pending.push_back(std::move(r));
+            h.reads = std::move(pending);
+        }
+        h.reads.push_back(e);
+    }
+}
+
+// staged transfers block on the staging buffers, so they don't keep the hazard lock: a user
+// event stands in for the transfer, and other lanes order against it meanwhile
+ecl::Event ecl::Computer::hold(cl_mem mem, bool write, const std::string& where){
+    cl_event e = clCreateUserEvent(context, &error);
+    checkError(where);
+
+    Event gate(e);
+    track(mem, write, gate);
+    return gate;
+}
+// the stand-in completes with the transfer, or fails with it
+void ecl::Computer::open(const Event& gate, Event& done){
+    cl_event e = gate.getEvent();
+    clRetainEvent(e);
+    done.then([e](cl_int status){
+        clSetUserEventStatus(e, status < 0 ? status : CL_COMPLETE);
+        clReleaseEvent(e);
+    });
+}
+
+// an empty range enqueues a task
+// offset is the global work offset, one per dimension
+ecl::Event ecl::Computer::launch(const std::vector<Argument>& args, cl_kernel kern, const std::vector<std::size_t>& global_work_size, const std::size_t* local_work_size, EXEC sync, const std::vector<Event>& wait, const std::string& where, const std::size_t* offset){
+    std::vector<Event> deps = wait;
+    for(const auto& a : args){
+        const Buffer* buf = a.getBuffer();
+        if(buf != nullptr && buf->getMapping(context) != nullptr) deps.push_back(send(const_cast<Buffer&>(*buf), ASYNC)); // received zero-copy buffer goes back to the device
+    }
+
+    std::unique_lock<std::mutex> guard(hazards->lock, std::defer_lock);
+    cl_command_queue lane = queue;
+
+    if(isTracked()){
+        guard.lock();
+        lane = lanes[next_lane++ % lanes.size()];
+        for(const auto& a : args){
+            const Buffer* buf = a.getBuffer();
+            if(buf != nullptr) depend(buf->getBuffer(context), buf->getAccess() != READ, deps);
+        }
+    }
+    auto wait_list = Event::getWaitList(deps);
+
+    cl_event e;
+    if(global_work_size.empty()) error = clEnqueueTask(lane, kern, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+    else error = clEnqueueNDRangeKernel(lane, kern, global_work_size.size(), offset, global_work_size.data(), local_work_size, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+    checkError(where);
+
+    Event result(e);
+    if(isTracked()){
+        for(const auto& a : args){
+            const Buffer* buf = a.getBuffer();
+            if(buf != nullptr) track(buf->getBuffer(context), buf->getAccess() != READ, result);
+        }
+        error = clFlush(lane);
+        checkError(where);
+        guard.unlock();
+    }
+    for(const auto& a : args){
+        Buffer* buf = const_cast<Buffer*>(a.getBuffer());
+        if(buf == nullptr) continue;
+
+        Memory::use(context, buf, e);
+        if(buf->isCoherent() && buf->getAccess() != READ) buf->markWritten(context, transfer, e);
+    }
+
+    if(sync == SYNC) await();
+    return result;
+}
+
+bool ecl::Computer::isSplit(const Frame& frame) const{
+    for(const auto& a : frame.args) if(a.getBuffer() != nullptr && a.getBuffer()->isSegmented()) return true;
+    return false;
+}
+
+// segmented arguments, the ones marked piecewise and arrays with one element per work-item
+// are cut to the piece, a whole copy of the last ones would be indexed from 0 in every piece
+bool ecl::Computer::isCut(const Argument& arg, std::size_t total){
+    const Buffer* buf = arg.getBuffer();
+    if(buf == nullptr) return false;
+    return buf->isSegmented() || arg.isPiecewise() || buf->getSize() == total * buf->getUnit();
+}
+
+// work-items of one piece when segmented arguments run the range piece by piece, as many
+// as the shortest segment holds, rounded down to a multiple of an explicit local size so
+// every piece divides into work-groups; cut arguments need one element per work-item
+std::size_t ecl::Computer::getPiece(const Frame& frame, const std::vector<std::size_t>& global_work_size, std::size_t multiple){
+    if(global_work_size.size() != 1) throw std::runtime_error("Computer [grid]: segmented arguments need a 1D range");
+    std::size_t total = global_work_size[0];
+    if(multiple == 0 || total % multiple != 0) throw std::runtime_error("Computer [grid]: local size doesn't divide the range");
+
+    std::size_t piece = total;
+    for(const auto& a : frame.args){
+        if(!isCut(a, total)) continue;
+
+        const Buffer* buf = a.getBuffer();
+        if(buf->getSize() != total * buf->getUnit()) throw std::runtime_error("Computer [grid]: range doesn't match segmented or piecewise argument");
+        if(buf->isSegmented()) piece = std::min(piece, buf->getSegments()[0]->getSize() / buf->getUnit());
+    }
+
+    piece = piece / multiple * multiple;
+    if(piece == 0) throw std::runtime_error("Computer [grid]: local size is larger than a segment");
+    return piece;
+}
+
+// arrays larger than one device allocation run piece by piece: cut arguments get the part of
+// the piece, the others go whole. Work-item ids start at 0 in every piece, so kernels have to
+// index cut arguments by get_global_id and mustn't use it as the element's position in the
+// whole range. Segments stay pinned until every piece is enqueued
+ecl::Event ecl::Computer::split(const Frame& frame, const std::vector<std::size_t>& global_work_size, const std::function<Event(const Frame&, const std::vector<std::size_t>&, const std::vector<Event>&)>& run, EXEC sync, const std::vector<Event>& wait, const std::string& where, std::size_t multiple){
+    std::size_t total = global_work_size.empty() ? 0 : global_work_size[0];
+    std::size_t piece = getPiece(frame, global_work_size, multiple);
+
+    std::vector<const Buffer*> pinned;
+    cl_event result;
+    try{
+        for(const auto& a : frame.args){
+            const Buffer* buf = a.getBuffer();
+            if(buf == nullptr) continue;
+
+            if(buf->isSegmented()){
+                for(auto* seg : buf->getSegments()){
+                    restore(*seg);
+                    Memory::pin(context, seg);
+                    pinned.push_back(seg);
+                }
+            }
+            else restore(*buf);
+            if(!buf->checkBuffer(context)) throw std::runtime_error(where + ": buffer wasn't sent to computer");
+        }
+
+        std::vector<Event> done;
+        for(std::size_t start = 0; start < total; start += piece){
+            std::size_t count = std::min(piece, total - start);
+
+            std::vector<std::unique_ptr<Buffer>> parts; // sub-buffers go once the commands using them complete
+            std::vector<Argument> args;
+            for(const auto& a : frame.args){
+                Buffer* buf = const_cast<Buffer*>(a.getBuffer());
+                if(!isCut(a, total)){
+                    args.push_back(a);
+                    continue;
+                }
+                parts.emplace_back(new Buffer(buf->part(context, start * buf->getUnit(), count * buf->getUnit())));
+                args.push_back(Argument(parts.back().get()));
+            }
+
+            Frame step = {frame.prog, frame.kern, args};
+            done.push_back(run(step, {count}, wait));
+        }
+
+        auto wait_list = Event::getWaitList(done);
+        error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &result);
+        checkError(where);
+    }catch(...){
+        for(auto* seg : pinned) Memory::unpin(context, seg);
+        throw;
+    }
+
+    // evicting a segment waits for the last piece
+    for(auto* seg : pinned){
+        Memory::use(context, seg, result);
+        Memory::unpin(context, seg);
+    }
+
+    if(sync == SYNC) await();
+    return Event(result);
 }
 
 ecl::Computer::operator cl_device_id() {
@@ -1522,41 +4481,302 @@ cl_context ecl::Computer::getContext() const{
 cl_command_queue ecl::Computer::getQueue() const{
     return queue;
 }
+cl_command_queue ecl::Computer::getTransferQueue() const{
+    return transfer;
+}
+const std::vector<cl_command_queue>& ecl::Computer::getQueues() const{
+    return lanes;
+}
 const std::string& ecl::Computer::getName() const{
     return name;
 }
 
-void ecl::Computer::send(ecl::Buffer& arg, EXEC sync) {
+ecl::Event ecl::Computer::send(ecl::Buffer& arg, EXEC sync, const std::vector<Event>& wait) {
+	if (recording != nullptr) {
+		recording->send(arg);
+		return Event();
+	}
+	arg.createBuffer(context);
+	if (arg.isSegmented()) return send(arg.getSegments(), sync, wait);
+	if (arg.isCoherent()) {
+		arg.fetch(); // a kernel elsewhere may have the latest data
+		if (arg.isCurrent(context)) return write(arg, {}, sync, wait);
+	}
+
+	std::vector<Range> ranges;
+	bool whole = !arg.takeDirty(context, ranges);
+	if (whole) ranges.assign(1, Range(0, arg.getSize()));
+
+	Event result = write(arg, ranges, sync, wait);
+	if (arg.isCoherent()) arg.markCurrent(context);
+	if (whole) Memory::setWritten(context, &arg, false); // the device copy is the host one again
+	return result;
+}
+// bytes of the buffer, the rest of the device copy is kept
+ecl::Event ecl::Computer::send(Buffer& arg, std::size_t offset, std::size_t size, EXEC sync, const std::vector<Event>& wait) {
+	if (recording != nullptr) throw std::runtime_error("Computer [send data]: ranges can't be recorded");
+	if (arg.isEvicted(context)) return send(arg, sync, wait); // the rest of the device copy is gone
 	arg.createBuffer(context);
+	if (arg.isSegmented()) throw std::runtime_error("Computer [send data]: ranges of segmented buffers aren't supported");
+	if (arg.isCoherent()) arg.fetch();
+	return write(arg, {Range(offset, size)}, sync, wait);
+}
+
+ecl::Event ecl::Computer::write(Buffer& arg, const std::vector<Range>& ranges, EXEC sync, const std::vector<Event>& wait) {
+	std::vector<Range> copies;
+	for (const auto& r : ranges) {
+		if (r.first + r.second > arg.getSize()) throw std::runtime_error("Computer [send data]: range is out of buffer");
+		if (r.second != 0) copies.push_back(r);
+	}
+	cl_mem mem = arg.getBuffer(context);
+	bool staged = false;
+	for (const auto& r : copies) staged = staged || isStaged(r.second);
+	staged = staged && !arg.isZeroCopy(context);
+
+	std::unique_lock<std::mutex> guard(hazards->lock, std::defer_lock);
+	std::vector<Event> deps = wait;
+	Event gate;
+	if (isTracked()) {
+		guard.lock();
+		depend(mem, true, deps);
+		if (staged) {
+			gate = hold(mem, true, "Computer [send data]");
+			guard.unlock();
+		}
+	}
+	auto wait_list = Event::getWaitList(deps);
+
+	Event result;
+	if (arg.isZeroCopy(context)) {
+		// the host memory is the buffer, handing it over to the device moves nothing
+		cl_event e;
+		void* mapping = arg.getMapping(context);
+		if (mapping != nullptr) error = clEnqueueUnmapMemObject(transfer, mem, mapping, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+		else error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+		checkError("Computer [send data]");
+
+		arg.setMapping(context, nullptr);
+		result = Event(e);
+	}
+	else if (copies.empty()) {
+		cl_event e;
+		error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+		checkError("Computer [send data]");
+
+		result = Event(e);
+	}
+	else {
+		const unsigned char* bytes = static_cast<const unsigned char*>(arg.getPtr());
+		try {
+			for (std::size_t i = 0; i < copies.size(); i++) {
+				// in-order queue, the first copy waits for the rest and the last one completes the transfer
+				std::vector<cl_event> first = i == 0 ? wait_list : std::vector<cl_event>();
+				std::size_t offset = copies[i].first, size = copies[i].second;
+				auto start = std::chrono::steady_clock::now();
+
+				if (isStaged(size)) result = stageSend(mem, offset, bytes + offset, size, first);
+				else {
+					cl_event e;
+					error = clEnqueueWriteBuffer(transfer, mem, CL_FALSE, offset, size, bytes + offset, first.size(), first.empty() ? nullptr : first.data(), &e);
+					checkError("Computer [send data]");
+
+					result = Event(e);
+				}
+				count(result, size, true, isStaged(size), start);
+			}
+		}
+		catch (...) {
+			if (gate.getEvent() != nullptr) clSetUserEventStatus(gate.getEvent(), CL_INVALID_OPERATION);
+			throw;
+		}
+	}
 
-	error = clEnqueueWriteBuffer(queue, arg.getBuffer(context), CL_FALSE, 0, arg.getSize(), arg.getPtr(), 0, nullptr, nullptr);
-	checkError("Computer [send data]");
+	if (gate.getEvent() != nullptr) open(gate, result);
+	else if (isTracked()) {
+		track(mem, true, result);
+		error = clFlush(transfer);
+		checkError("Computer [send data]");
+		guard.unlock();
+	}
+	Memory::use(context, &arg, result.getEvent());
 
     if(sync == SYNC) await();
+    return result;
 }
-void ecl::Computer::send(const std::vector<Buffer*>& args, EXEC sync){
-    std::size_t count = args.size();
-    for(std::size_t i(0); i < count; i++) send(*args[i], ASYNC);
+// one marker event stands for the whole batch
+ecl::Event ecl::Computer::send(const std::vector<Buffer*>& args, EXEC sync, const std::vector<Event>& wait){
+    std::vector<Event> sent;
+    for(auto* arg : args) sent.push_back(send(*arg, ASYNC, wait));
+
+    auto wait_list = Event::getWaitList(sent);
+
+    cl_event result;
+    error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &result);
+    checkError("Computer [send data]");
     
 	if(sync == SYNC) await();
+    return Event(result);
+}
+// coherent buffers are only copied when this device has the data the host lacks
+ecl::Event ecl::Computer::receive(Buffer& arg, EXEC sync, const std::vector<Event>& wait) {
+	if (recording != nullptr) {
+		recording->receive(arg);
+		return Event();
+	}
+	if (arg.isSegmented()) return receive(arg.getSegments(), sync, wait);
+	if (arg.isCoherent() && (arg.isHostCurrent() || !arg.isCurrent(context))) {
+		arg.fetch();
+		return read(arg, {}, sync, wait);
+	}
+
+	Event result = read(arg, {Range(0, arg.getSize())}, sync, wait);
+	if (arg.isCoherent()) arg.markHost(result.getEvent());
+	Memory::setWritten(context, &arg, false); // the host has what the device wrote
+	return result;
+}
+ecl::Event ecl::Computer::receive(Buffer& arg, std::size_t offset, std::size_t size, EXEC sync, const std::vector<Event>& wait) {
+	if (recording != nullptr) throw std::runtime_error("Computer [receive data]: ranges can't be recorded");
+	if (arg.isSegmented()) throw std::runtime_error("Computer [receive data]: ranges of segmented buffers aren't supported");
+	if (arg.isCoherent()) return receive(arg, sync, wait);
+	return read(arg, {Range(offset, size)}, sync, wait);
 }
-void ecl::Computer::receive(Buffer& arg, EXEC sync) {
+
+ecl::Event ecl::Computer::read(Buffer& arg, const std::vector<Range>& ranges, EXEC sync, const std::vector<Event>& wait) {
+	if (arg.isEvicted(context)) { // host memory got the device copy when it was evicted
+		auto wait_list = Event::getWaitList(wait);
+
+		cl_event e;
+		error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+		checkError("Computer [receive data]");
+
+		Event result(e);
+		if(sync == SYNC) await();
+		return result;
+	}
+
 	bool sended = arg.checkBuffer(context);
 	if (!sended) throw std::runtime_error("Computer [receive]: buffer wasn't sent to computer");
 	if (arg.getAccess() == READ) throw std::runtime_error("Computer [receive]: trying to receive read-only data");
 
-	error = clEnqueueReadBuffer(queue, arg.getBuffer(context), CL_FALSE, 0, arg.getSize(), arg.getPtr(), 0, nullptr, nullptr);
-	checkError("Computer [receive data]");
+	std::vector<Range> copies;
+	for (const auto& r : ranges) {
+		if (r.first + r.second > arg.getSize()) throw std::runtime_error("Computer [receive data]: range is out of buffer");
+		if (r.second != 0) copies.push_back(r);
+	}
+	cl_mem mem = arg.getBuffer(context);
+	bool staged = false;
+	for (const auto& r : copies) staged = staged || isStaged(r.second);
+	staged = staged && !arg.isZeroCopy(context);
+
+	std::unique_lock<std::mutex> guard(hazards->lock, std::defer_lock);
+	std::vector<Event> deps = wait;
+	Event gate;
+	if (isTracked()) {
+		guard.lock();
+		depend(mem, false, deps);
+		if (staged) {
+			gate = hold(mem, false, "Computer [receive data]");
+			guard.unlock();
+		}
+	}
+	auto wait_list = Event::getWaitList(deps);
+
+	Event result;
+	if (arg.isZeroCopy(context)) {
+		// mapping gives the host memory back, it already holds the results
+		cl_event e;
+		if (arg.getMapping(context) == nullptr) {
+			void* mapping = clEnqueueMapBuffer(transfer, mem, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, arg.getSize(), wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e, &error);
+			checkError("Computer [receive data]");
+			arg.setMapping(context, mapping);
+		}
+		else {
+			error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+			checkError("Computer [receive data]");
+		}
+		result = Event(e);
+	}
+	else if (copies.empty()) {
+		cl_event e;
+		error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+		checkError("Computer [receive data]");
+
+		result = Event(e);
+	}
+	else {
+		unsigned char* bytes = static_cast<unsigned char*>(arg.getPtr());
+		try {
+			for (std::size_t i = 0; i < copies.size(); i++) {
+				std::vector<cl_event> first = i == 0 ? wait_list : std::vector<cl_event>();
+				std::size_t offset = copies[i].first, size = copies[i].second;
+				auto start = std::chrono::steady_clock::now();
+
+				if (isStaged(size)) result = stageReceive(mem, offset, bytes + offset, size, first);
+				else {
+					cl_event e;
+					error = clEnqueueReadBuffer(transfer, mem, CL_FALSE, offset, size, bytes + offset, first.size(), first.empty() ? nullptr : first.data(), &e);
+					checkError("Computer [receive data]");
+
+					result = Event(e);
+				}
+				count(result, size, false, isStaged(size), start);
+			}
+		}
+		catch (...) {
+			if (gate.getEvent() != nullptr) clSetUserEventStatus(gate.getEvent(), CL_INVALID_OPERATION);
+			throw;
+		}
+		// the device copies of other contexts miss what was read into host memory
+		if (arg.isTracking()) for (const auto& r : copies) arg.markDirty(r.first, r.second, context);
+	}
+
+	if (gate.getEvent() != nullptr) open(gate, result);
+	else if (isTracked()) {
+		track(mem, false, result);
+		error = clFlush(transfer);
+		checkError("Computer [receive data]");
+		guard.unlock();
+	}
+	Memory::use(context, &arg, result.getEvent());
 
     if(sync == SYNC) await();
+    return result;
 }
-void ecl::Computer::receive(const std::vector<Buffer*>& args, EXEC sync){
-    std::size_t count = args.size();
-	for (std::size_t i(0); i < count; i++) receive(*args[i], ASYNC);
+ecl::Event ecl::Computer::receive(const std::vector<Buffer*>& args, EXEC sync, const std::vector<Event>& wait){
+    std::vector<Event> received;
+    for(auto* arg : args) received.push_back(receive(*arg, ASYNC, wait));
+
+    auto wait_list = Event::getWaitList(received);
+
+    cl_event result;
+    error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &result);
+    checkError("Computer [receive data]");
 
     if(sync == SYNC) await();
+    return Event(result);
 }
 void ecl::Computer::release(Buffer& arg, EXEC sync) {
+	if (arg.isSegmented()) {
+		release(arg.getSegments(), ASYNC);
+		arg.releaseBuffer(context);
+		if(sync == SYNC) await();
+		return;
+	}
+	if (arg.isCoherent() && arg.checkBuffer(context)) arg.fetch(); // the device copy may be the only one
+	if (isTracked() && arg.checkBuffer(context)) {
+		// the pool keeps the memory until the other lanes are done with it
+		std::lock_guard<std::mutex> guard(hazards->lock);
+		cl_mem mem = arg.getBuffer(context);
+		auto it = hazards->table.find(mem);
+		if (it != hazards->table.end()) hazards->table.erase(it); // a slice leaves them to its array
+	}
+	if (arg.checkBuffer(context) && arg.getMapping(context) != nullptr) {
+		error = clEnqueueUnmapMemObject(transfer, arg.getBuffer(context), arg.getMapping(context), 0, nullptr, nullptr);
+		checkError("Computer [release]");
+
+		error = clFinish(transfer);
+		checkError("Computer [release]");
+	}
 	arg.releaseBuffer(context);
 
     if(sync == SYNC) await();
@@ -1566,6 +4786,434 @@ void ecl::Computer::release(const std::vector<Buffer*>& args, EXEC sync){
     
     if(sync == SYNC) await();
 }
+// kernel gets (input chunk, output chunk, frame arguments...) and one work-item per element;
+// producer fills up to chunk elements and returns how many, 0 ends the stream, consumer gets
+// the results in order. depth chunks are in flight; transfers share one in-order queue, so the
+// upload of a chunk is enqueued ahead of the download of the previous one and runs while that
+// chunk computes on another lane
+template<typename T, typename U>
+void ecl::Computer::pipe(const Frame& frame, const std::function<std::size_t(T*, std::size_t)>& producer, const std::function<void(const U*, std::size_t)>& consumer, std::size_t chunk, std::size_t depth){
+    if(chunk == 0 || depth == 0) throw std::runtime_error("Computer [stream]: chunk and depth must be positive");
+
+    struct Slot{
+        std::vector<T> input;
+        std::vector<U> output;
+        array<T> in;
+        array<U> out;
+        Event done; // download of the chunk
+        std::size_t count = 0;
+
+        Slot(std::size_t chunk) : input(chunk), output(chunk), in(input.data(), chunk, READ), out(output.data(), chunk, WRITE){
+        }
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    for(std::size_t i = 0; i < depth; i++){
+        slots.emplace_back(new Slot(chunk));
+        slots.back()->out.createBuffer(context);
+    }
+
+    auto finish = [&](Slot& slot){
+        if(slot.count == 0) return;
+        slot.done.await();
+        consumer(slot.output.data(), slot.count);
+        slot.count = 0;
+    };
+
+    // the download of the last computed chunk waits for the next upload
+    Slot* computed = nullptr;
+    Event run;
+    auto download = [&](){
+        if(computed == nullptr) return;
+        computed->done = receive(computed->out, ASYNC, {run});
+        computed = nullptr;
+    };
+
+    std::size_t k = 0;
+    try{
+        for(;; k++){
+            Slot& slot = *slots[k % depth];
+            if(computed == &slot) download(); // depth 1
+            finish(slot);
+
+            std::size_t count = producer(slot.input.data(), chunk);
+            if(count == 0) break;
+            if(count > chunk) throw std::runtime_error("Computer [stream]: producer overflowed the chunk");
+
+            std::vector<Argument> args = {Argument(&slot.in), Argument(&slot.out)};
+            args.insert(args.end(), frame.args.begin(), frame.args.end());
+            Frame step = {frame.prog, frame.kern, args};
+
+            Event up = send(slot.in, ASYNC);
+            download();
+
+            run = grid(step, {count}, ASYNC, {up});
+            computed = &slot;
+            slot.count = count;
+        }
+        download();
+        for(std::size_t i = 1; i < depth; i++) finish(*slots[(k + i) % depth]);
+    }
+    catch(...){
+        await(); // commands in flight still point at the slots
+        throw;
+    }
+
+    for(auto& slot : slots){
+        release(slot->in, ASYNC);
+        release(slot->out, ASYNC);
+    }
+}
+template<typename T, typename U>
+void ecl::Computer::stream(const Frame& frame, const T* input, U* output, std::size_t count, std::size_t chunk, std::size_t depth){
+    std::size_t produced = 0;
+    std::size_t consumed = 0;
+
+    std::function<std::size_t(T*, std::size_t)> producer = [&](T* dst, std::size_t n){
+        n = std::min(n, count - produced);
+        std::copy(input + produced, input + produced + n, dst);
+        produced += n;
+        return n;
+    };
+    std::function<void(const U*, std::size_t)> consumer = [&](const U* src, std::size_t n){
+        std::copy(src, src + n, output + consumed);
+        consumed += n;
+    };
+
+    pipe(frame, producer, consumer, chunk, depth);
+}
+// element types come from the parameters of the callbacks, so they can't be generic lambdas
+template<typename P, typename C, typename>
+void ecl::Computer::stream(const Frame& frame, P producer, C consumer, std::size_t chunk, std::size_t depth){
+    typedef typename Callback<P>::type T;
+    typedef typename Callback<C>::type U;
+
+    pipe<T, U>(frame, producer, consumer, chunk, depth);
+}
+
+// send, receive, grid and task go into the graph until stop; what they return then is empty,
+// the graph orders its nodes by the buffers they use
+void ecl::Computer::record(Graph& graph) {
+	if (recording != nullptr) throw std::runtime_error("Computer [record]: already recording");
+	graph.begin(*this);
+	recording = &graph;
+	graph.recorder = this;
+}
+void ecl::Computer::stop() {
+	if (recording != nullptr) recording->recorder = nullptr;
+	recording = nullptr;
+}
+
+// device memory the buffers of the context may take before least recently used ones are
+// evicted to host memory, shared by computers of a shared context
+void ecl::Computer::setBudget(std::size_t bytes) {
+	Memory::setBudget(context, bytes);
+}
+std::size_t ecl::Computer::getBudget() const {
+	return Memory::getBudget(context);
+}
+void ecl::Computer::setLimit(std::size_t bytes) {
+	Memory::setLimit(context, bytes);
+}
+std::size_t ecl::Computer::getLimit() const {
+	return Memory::getLimit(context);
+}
+ecl::Memory::Stats ecl::Computer::getMemoryStats() const {
+	return Memory::getStats(context);
+}
+std::vector<ecl::Memory::Usage> ecl::Computer::getLargest(std::size_t count) const {
+	return Memory::getLargest(context, count);
+}
+
+// chunk 0 turns staging off
+void ecl::Computer::setStaging(std::size_t chunk, std::size_t count) {
+	if (count == 0) throw std::runtime_error("Computer [staging]: no staging buffers");
+
+	std::lock_guard<std::mutex> guard(staging_lock);
+	releaseStaging();
+	staging_size = chunk;
+	staging_count = count;
+}
+// transfers of a single chunk gain nothing from the extra host copy
+bool ecl::Computer::isStaged(std::size_t size) const {
+	return staging_size != 0 && size > staging_size;
+}
+void ecl::Computer::checkStaging() {
+	while (staging.size() < staging_count) {
+		cl_mem mem = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, staging_size, nullptr, &error);
+		checkError("Computer [staging]");
+
+		void* ptr = clEnqueueMapBuffer(transfer, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, staging_size, 0, nullptr, nullptr, &error);
+		if (error != 0) clReleaseMemObject(mem);
+		checkError("Computer [staging]");
+
+		staging.push_back(Staging{mem, ptr, Event()});
+	}
+}
+void ecl::Computer::releaseStaging() {
+	for (auto& slot : staging) {
+		slot.busy.await();
+		clEnqueueUnmapMemObject(transfer, slot.mem, slot.ptr, 0, nullptr, nullptr);
+	}
+	if (!staging.empty()) clFinish(transfer);
+	for (auto& slot : staging) clReleaseMemObject(slot.mem);
+	staging.clear();
+}
+
+// pageable memory is copied into pinned chunks on the host while the previous chunk is
+// still on the bus, so the transfer runs at pinned bandwidth
+ecl::Event ecl::Computer::stageSend(cl_mem mem, std::size_t offset, const void* src, std::size_t size, const std::vector<cl_event>& wait) {
+	std::lock_guard<std::mutex> guard(staging_lock);
+	checkStaging();
+
+	const unsigned char* bytes = static_cast<const unsigned char*>(src);
+	Event result;
+	for (std::size_t done = 0, i = 0; done < size; done += staging_size, i++) {
+		Staging& slot = staging[i % staging.size()];
+		std::size_t n = std::min(staging_size, size - done);
+
+		slot.busy.await();
+		std::memcpy(slot.ptr, bytes + done, n);
+
+		cl_event e;
+		bool first = i == 0 && !wait.empty();
+		error = clEnqueueWriteBuffer(transfer, mem, CL_FALSE, offset + done, n, slot.ptr, first ? wait.size() : 0, first ? wait.data() : nullptr, &e);
+		checkError("Computer [send data]");
+
+		error = clFlush(transfer);
+		checkError("Computer [send data]");
+
+		slot.busy = Event(e);
+		result = slot.busy; // in-order queue, the last chunk completes the transfer
+	}
+	return result;
+}
+// returns once the data is in host memory
+ecl::Event ecl::Computer::stageReceive(cl_mem mem, std::size_t offset, void* dst, std::size_t size, const std::vector<cl_event>& wait) {
+	std::lock_guard<std::mutex> guard(staging_lock);
+	checkStaging();
+
+	unsigned char* bytes = static_cast<unsigned char*>(dst);
+	std::vector<std::pair<std::size_t, std::size_t>> pending(staging.size(), std::make_pair(0, 0)); // chunk in every slot
+
+	auto drain = [&](std::size_t s) {
+		if (pending[s].second == 0) return;
+
+		staging[s].busy.await();
+		std::memcpy(bytes + pending[s].first, staging[s].ptr, pending[s].second);
+		pending[s].second = 0;
+	};
+
+	Event result;
+	std::size_t i = 0;
+	for (std::size_t done = 0; done < size; done += staging_size, i++) {
+		std::size_t s = i % staging.size();
+		std::size_t n = std::min(staging_size, size - done);
+		drain(s);
+
+		cl_event e;
+		bool first = i == 0 && !wait.empty();
+		error = clEnqueueReadBuffer(transfer, mem, CL_FALSE, offset + done, n, staging[s].ptr, first ? wait.size() : 0, first ? wait.data() : nullptr, &e);
+		checkError("Computer [receive data]");
+
+		error = clFlush(transfer);
+		checkError("Computer [receive data]");
+
+		staging[s].busy = Event(e);
+		pending[s] = std::make_pair(done, n);
+		result = staging[s].busy;
+	}
+	for (std::size_t k = 0; k < staging.size(); k++) drain((i + k) % staging.size());
+
+	return result;
+}
+
+// time is taken when the transfer completes, overlapping transfers are counted in full
+void ecl::Computer::count(Event e, std::size_t bytes, bool sent, bool staged, std::chrono::steady_clock::time_point start) {
+	std::shared_ptr<Counters> c = counters;
+	e.then([c, bytes, sent, staged, start](cl_int status) {
+		if (status != CL_COMPLETE) return;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> guard(c->lock);
+		if (sent) {
+			c->traffic.sent += bytes;
+			c->traffic.send_time += seconds;
+		}
+		else {
+			c->traffic.received += bytes;
+			c->traffic.receive_time += seconds;
+		}
+		if (staged) c->traffic.staged += bytes;
+	});
+}
+ecl::Computer::Traffic ecl::Computer::getTraffic() const {
+	std::lock_guard<std::mutex> guard(counters->lock);
+	return counters->traffic;
+}
+void ecl::Computer::resetTraffic() {
+	std::lock_guard<std::mutex> guard(counters->lock);
+	counters->traffic = Traffic();
+}
+
+// moves the buffer to this device ahead of use, between computers of a shared context
+ecl::Event ecl::Computer::migrate(Buffer& arg, EXEC sync, const std::vector<Event>& wait) {
+	restore(arg);
+	if (!arg.checkBuffer(context)) throw std::runtime_error("Computer [migrate]: buffer wasn't sent to computer");
+	cl_mem mem = arg.getBuffer(context);
+
+	return submit({std::make_pair(&arg, true)}, [&](cl_uint n, const cl_event* list, cl_event* e) {
+		return clEnqueueMigrateMemObjects(transfer, 1, &mem, 0, n, list, e);
+	}, sync, wait, "Computer [migrate]");
+}
+
+// buffers evicted from this context are uploaded again before use
+void ecl::Computer::restore(const Buffer& arg) {
+	if (arg.isSegmented()) for (auto* seg : arg.getSegments()) restore(*seg);
+	else if (arg.isEvicted(context)) send(const_cast<Buffer&>(arg), ASYNC);
+}
+
+// one command on the transfer queue, ordered against the buffers it reads and writes
+ecl::Event ecl::Computer::submit(const std::vector<std::pair<Buffer*, bool>>& touched, const std::function<cl_int(cl_uint, const cl_event*, cl_event*)>& command, EXEC sync, const std::vector<Event>& wait, const std::string& where) {
+	std::vector<Event> deps = wait;
+	for (const auto& t : touched) {
+		bool stale = t.first->isCoherent() && !t.first->isCurrent(context);
+		if (stale || t.first->getMapping(context) != nullptr) deps.push_back(send(*t.first, ASYNC)); // zero-copy buffer goes back to the device
+	}
+
+	std::unique_lock<std::mutex> guard(hazards->lock, std::defer_lock);
+	if (isTracked()) {
+		guard.lock();
+		for (const auto& t : touched) depend(t.first->getBuffer(context), t.second, deps);
+	}
+	auto wait_list = Event::getWaitList(deps);
+
+	cl_event e;
+	error = command(wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+	checkError(where);
+
+	Event result(e);
+	if (isTracked()) {
+		for (const auto& t : touched) track(t.first->getBuffer(context), t.second, result);
+		error = clFlush(transfer);
+		checkError(where);
+		guard.unlock();
+	}
+	for (const auto& t : touched) Memory::use(context, t.first, e);
+
+    if(sync == SYNC) await();
+    return result;
+}
+
+ecl::Event ecl::Computer::copy(const Buffer& src, Buffer& dst, EXEC sync, const std::vector<Event>& wait) {
+	return copy(src, 0, dst, 0, src.getSize(), sync, wait);
+}
+// bytes between buffers already on the device, the destination is created when missing
+ecl::Event ecl::Computer::copy(const Buffer& src, std::size_t src_offset, Buffer& dst, std::size_t dst_offset, std::size_t size, EXEC sync, const std::vector<Event>& wait) {
+	checkCopy(src, src_offset, dst, dst_offset, size);
+	restore(src);
+	restore(dst);
+	if (!src.checkBuffer(context)) throw std::runtime_error("Computer [copy]: buffer wasn't sent to computer");
+
+	dst.createBuffer(context);
+	cl_mem from = src.getBuffer(context);
+	cl_mem to = dst.getBuffer(context);
+
+	Event result = submit({std::make_pair(const_cast<Buffer*>(&src), false), std::make_pair(&dst, true)}, [&](cl_uint n, const cl_event* list, cl_event* e) {
+		return clEnqueueCopyBuffer(transfer, from, to, src_offset, dst_offset, size, n, list, e);
+	}, sync, wait, "Computer [copy]");
+	if (dst.isCoherent()) dst.markWritten(context, transfer, result.getEvent());
+	Memory::setWritten(context, &dst, true);
+	return result;
+}
+// region is bytes in row, rows and slices; missing dimensions are 1
+ecl::Event ecl::Computer::copyRect(const Buffer& src, const Rect& from, Buffer& dst, const Rect& to, const std::vector<std::size_t>& region, EXEC sync, const std::vector<Event>& wait) {
+	checkCopy(src, from, dst, to, region);
+	restore(src);
+	restore(dst);
+	if (!src.checkBuffer(context)) throw std::runtime_error("Computer [copy]: buffer wasn't sent to computer");
+
+	std::size_t src_origin[3] = {0, 0, 0}, dst_origin[3] = {0, 0, 0}, size[3] = {1, 1, 1};
+	std::copy(from.origin.begin(), from.origin.end(), src_origin);
+	std::copy(to.origin.begin(), to.origin.end(), dst_origin);
+	std::copy(region.begin(), region.end(), size);
+
+	dst.createBuffer(context);
+	cl_mem src_mem = src.getBuffer(context);
+	cl_mem dst_mem = dst.getBuffer(context);
+
+	Event result = submit({std::make_pair(const_cast<Buffer*>(&src), false), std::make_pair(&dst, true)}, [&](cl_uint n, const cl_event* list, cl_event* e) {
+		return clEnqueueCopyBufferRect(transfer, src_mem, dst_mem, src_origin, dst_origin, size, from.row_pitch, from.slice_pitch, to.row_pitch, to.slice_pitch, n, list, e);
+	}, sync, wait, "Computer [copy]");
+	if (dst.isCoherent()) dst.markWritten(context, transfer, result.getEvent());
+	Memory::setWritten(context, &dst, true);
+	return result;
+}
+// pattern size is a power of two up to 128 bytes, offset and size are multiples of it
+ecl::Event ecl::Computer::fill(Buffer& arg, const void* pattern, std::size_t pattern_size, std::size_t offset, std::size_t size, EXEC sync, const std::vector<Event>& wait) {
+	checkFill(arg, pattern, pattern_size, offset, size);
+	restore(arg);
+
+	arg.createBuffer(context);
+	cl_mem mem = arg.getBuffer(context);
+
+	Event result = submit({std::make_pair(&arg, true)}, [&](cl_uint n, const cl_event* list, cl_event* e) {
+		return clEnqueueFillBuffer(transfer, mem, pattern, pattern_size, offset, size, n, list, e);
+	}, sync, wait, "Computer [fill]");
+	if (arg.isCoherent()) arg.markWritten(context, transfer, result.getEvent());
+	Memory::setWritten(context, &arg, true);
+	return result;
+}
+template<typename T>
+ecl::Event ecl::Computer::fill(Buffer& arg, const T& value, EXEC sync, const std::vector<Event>& wait) {
+	return fill(arg, &value, sizeof(T), 0, arg.getSize() / sizeof(T) * sizeof(T), sync, wait);
+}
+// only the device memory is copied, the host elements of the clone stay as allocated until received
+template<typename T>
+ecl::array<T> ecl::Computer::clone(const array<T>& src, EXEC sync, const std::vector<Event>& wait) {
+	array<T> result(src.getArraySize(), src.getAccess(), src.getMemory());
+	Event e = copy(src, result, sync, wait);
+	if (src.isCoherent()) {
+		result.setCoherent(true);
+		result.markWritten(context, transfer, e.getEvent()); // the host elements were never set
+	}
+	return result;
+}
+
+// ranges are checked without a device, sums are kept from wrapping around
+void ecl::Computer::checkCopy(const Buffer& src, std::size_t src_offset, const Buffer& dst, std::size_t dst_offset, std::size_t size) {
+	if (size > src.getSize() || src_offset > src.getSize() - size) throw std::runtime_error("Computer [copy]: range is out of buffer");
+	if (size > dst.getSize() || dst_offset > dst.getSize() - size) throw std::runtime_error("Computer [copy]: range is out of buffer");
+	if (&src == &dst && size != 0 && src_offset < dst_offset + size && dst_offset < src_offset + size) throw std::runtime_error("Computer [copy]: ranges overlap");
+}
+void ecl::Computer::checkCopy(const Buffer& src, const Rect& from, const Buffer& dst, const Rect& to, const std::vector<std::size_t>& region) {
+	if (region.empty() || region.size() > 3 || from.origin.size() > 3 || to.origin.size() > 3) throw std::runtime_error("Computer [copy]: rect has more than 3 dimensions");
+
+	std::size_t size[3] = {1, 1, 1};
+	std::copy(region.begin(), region.end(), size);
+	if (size[0] == 0 || size[1] == 0 || size[2] == 0) throw std::runtime_error("Computer [copy]: region is empty");
+
+	// one past the last byte of the rect, zero pitches are tightly packed
+	auto fits = [&](const Rect& rect, const Buffer& buf) {
+		std::size_t origin[3] = {0, 0, 0};
+		std::copy(rect.origin.begin(), rect.origin.end(), origin);
+
+		std::size_t row = rect.row_pitch == 0 ? size[0] : rect.row_pitch;
+		std::size_t slice = rect.slice_pitch == 0 ? size[1] * row : rect.slice_pitch;
+		if (row < size[0] || slice < size[1] * row || slice % row != 0) throw std::runtime_error("Computer [copy]: pitch is smaller than region");
+
+		double last = (double)(origin[2] + size[2] - 1) * slice + (double)(origin[1] + size[1] - 1) * row + (double)(origin[0] + size[0]);
+		if (last > (double)buf.getSize()) throw std::runtime_error("Computer [copy]: rect is out of buffer");
+	};
+	fits(from, src);
+	fits(to, dst);
+}
+void ecl::Computer::checkFill(const Buffer& arg, const void* pattern, std::size_t pattern_size, std::size_t offset, std::size_t size) {
+	if (pattern == nullptr || pattern_size == 0 || pattern_size > 128 || (pattern_size & (pattern_size - 1)) != 0) throw std::runtime_error("Computer [fill]: pattern size isn't a power of two up to 128");
+	if (offset % pattern_size != 0 || size % pattern_size != 0) throw std::runtime_error("Computer [fill]: range isn't a multiple of pattern");
+	if (size > arg.getSize() || offset > arg.getSize() - size) throw std::runtime_error("Computer [fill]: range is out of buffer");
+}
+
 void ecl::Computer::grab(Buffer& arg, EXEC sync) {
 	receive(arg, sync);
 	release(arg, sync);
@@ -1593,14 +5241,27 @@ namespace ecl {
 }
 
 void ecl::Computer::clear(){
-	if (queue != nullptr) {
-		error = clFlush(queue);
+	stop();
+	releaseStaging();
+	counters.reset();
+	hazards.reset();
+	tracked = false;
+	if (transfer != nullptr && transfer != queue) lanes.push_back(transfer);
+	if (lanes.empty() && queue != nullptr) lanes.push_back(queue);
+	for (auto q : lanes) {
+		error = clFlush(q);
 		checkError("Computer [clear]");
 
-		error = clReleaseCommandQueue(queue);
+		error = clReleaseCommandQueue(q);
 		checkError("Computer [clear]");
 	}
 	if (context != nullptr) {
+		Pool::trim(context);
+
+		cl_uint references = 0;
+		clGetContextInfo(context, CL_CONTEXT_REFERENCE_COUNT, sizeof(references), &references, nullptr);
+		if (references == 1) Memory::forget(context); // the last computer of the context
+
 		error = clReleaseContext(context);
 		checkError("Computer [clear]");
 	}
@@ -1609,8 +5270,615 @@ void ecl::Computer::clear(){
 	device = nullptr;
 	queue = nullptr;
 	context = nullptr;
+	lanes.clear();
+	transfer = nullptr;
+	next_lane = 0;
 }
 
 ecl::Computer::~Computer(){
 	clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plan Class Definition
+///////////////////////////////////////////////////////////////////////////////
+void ecl::Plan::move(Plan& other){
+    clear();
+
+    video = other.video;
+    context = other.context;
+    kernel = other.kernel;
+    args = std::move(other.args);
+    bound = std::move(other.bound);
+
+    other.video = nullptr;
+    other.context = nullptr;
+    other.kernel = nullptr;
+    other.args.clear();
+    other.bound.clear();
+}
+
+ecl::Plan::Plan(Computer& video, const Frame& frame){
+    context = video.getContext();
+
+    frame.prog.checkProgram(context, video.getDevice());
+    cl_program prog = frame.prog.getProgram(context);
+
+    kernel = clCreateKernel(prog, frame.kern.getName().c_str(), &error);
+    checkError("Plan [init]");
+    this->video = &video;
+
+    args = frame.args;
+    bound.assign(args.size(), nullptr);
+    try{
+        for(std::size_t i = 0; i < args.size(); i++)
+            if(args[i].getBuffer() == nullptr) args[i].bind(kernel, i, context, "Plan [init]");
+        bind("Plan [init]");
+        unpin();
+    }catch(...){
+        clear();
+        throw;
+    }
+}
+
+ecl::Plan::Plan(Plan&& other){
+    move(other);
+}
+ecl::Plan& ecl::Plan::operator=(Plan&& other){
+    move(other);
+    return *this;
+}
+
+cl_kernel ecl::Plan::getKernel() const{
+    return kernel;
+}
+
+// evicted arguments come back and stale coherent ones are uploaded, like grid does; all of them
+// stay pinned until unpin, so nothing is evicted between binding and the launch. Only arguments
+// whose buffer was reallocated since the last launch are set again, values and local sizes are
+// bound once by the constructor and set()
+void ecl::Plan::bind(const std::string& where){
+    if(video == nullptr) throw std::runtime_error(where + ": plan is empty");
+
+    std::size_t count = args.size();
+    std::size_t pinned = 0;
+    try{
+        for(; pinned < count; pinned++){
+            Buffer* curr = const_cast<Buffer*>(args[pinned].getBuffer());
+            if(curr == nullptr) continue;
+
+            video->restore(*curr);
+            if(!curr->checkBuffer(context)) throw std::runtime_error(where + ": buffer wasn't sent to computer");
+            if(curr->isCoherent() && !curr->isCurrent(context)) video->send(*curr, ASYNC);
+
+            cl_mem buf = curr->getBuffer(context);
+            if(buf != bound[pinned]){
+                error = clSetKernelArg(kernel, pinned, sizeof(cl_mem), &buf);
+                checkError(where);
+                bound[pinned] = buf;
+            }
+            Memory::pin(context, curr);
+        }
+    }catch(...){
+        for(std::size_t i = 0; i < pinned; i++) if(args[i].getBuffer() != nullptr) Memory::unpin(context, args[i].getBuffer());
+        throw;
+    }
+}
+void ecl::Plan::unpin(){
+    for(const auto& a : args) if(a.getBuffer() != nullptr) Memory::unpin(context, a.getBuffer());
+}
+
+void ecl::Plan::set(std::size_t i, const Argument& arg){
+    if(i >= args.size()) throw std::runtime_error("Plan [set]: invalid argument index");
+
+    args[i] = arg;
+    bound[i] = nullptr;
+    if(arg.getBuffer() == nullptr) arg.bind(kernel, i, context, "Plan [set]");
+}
+
+// launches share the lanes and the hazard table of the computer, like its own grid and task
+ecl::Event ecl::Plan::grid(const std::vector<std::size_t>& global_work_size, const std::vector<std::size_t>& local_work_size, EXEC sync, const std::vector<Event>& wait){
+    return run(global_work_size, local_work_size.data(), sync, wait, "Plan [grid]");
+}
+ecl::Event ecl::Plan::grid(const std::vector<std::size_t>& global_work_size, EXEC sync, const std::vector<Event>& wait){
+    return run(global_work_size, nullptr, sync, wait, "Plan [grid]");
+}
+ecl::Event ecl::Plan::task(EXEC sync, const std::vector<Event>& wait){
+    return run({}, nullptr, sync, wait, "Plan [task]");
+}
+ecl::Event ecl::Plan::run(const std::vector<std::size_t>& global_work_size, const std::size_t* local_work_size, EXEC sync, const std::vector<Event>& wait, const std::string& where){
+    bind(where);
+    Event result;
+    try{
+        result = video->launch(args, kernel, global_work_size, local_work_size, ASYNC, wait, where);
+    }catch(...){
+        unpin();
+        throw;
+    }
+    unpin();
+
+    if(sync == SYNC) video->await();
+    return result;
+}
+
+void ecl::Plan::clear(){
+    if(kernel != nullptr) clReleaseKernel(kernel);
+
+    video = nullptr;
+    context = nullptr;
+    kernel = nullptr;
+    args.clear();
+    bound.clear();
+}
+
+ecl::Plan::~Plan(){
+    clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Graph Class Definition
+///////////////////////////////////////////////////////////////////////////////
+void ecl::Graph::move(Graph& other){
+    clear();
+
+    context = other.context;
+    queue = other.queue;
+    transfer = other.transfer;
+    nodes = std::move(other.nodes);
+    access = std::move(other.access);
+    last = std::move(other.last);
+    recorder = other.recorder;
+    if(recorder != nullptr) recorder->recording = this;
+
+    other.recorder = nullptr;
+    other.context = nullptr;
+    other.queue = nullptr;
+    other.transfer = nullptr;
+    other.nodes.clear();
+    other.access.clear();
+}
+
+ecl::Graph::Graph(Graph&& other){
+    move(other);
+}
+ecl::Graph& ecl::Graph::operator=(Graph&& other){
+    move(other);
+    return *this;
+}
+
+void ecl::Graph::begin(Computer& video){
+    clear();
+
+    error = clRetainCommandQueue(video.getQueue());
+    checkError("Graph [record]");
+    queue = video.getQueue();
+
+    error = clRetainCommandQueue(video.getTransferQueue());
+    checkError("Graph [record]");
+    transfer = video.getTransferQueue();
+
+    context = video.getContext();
+}
+
+// read after write, write after read and write after write, as the hazards of a Computer
+void ecl::Graph::add(Node node, const std::vector<std::pair<const Buffer*, bool>>& touched){
+    std::size_t index = nodes.size();
+
+    std::set<std::size_t> deps;
+    for(const auto& t : touched){
+        auto it = access.find(t.first);
+        if(it == access.end()) continue;
+
+        if(it->second.written) deps.insert(it->second.write);
+        if(t.second) deps.insert(it->second.reads.begin(), it->second.reads.end());
+    }
+    node.deps.assign(deps.begin(), deps.end());
+
+    for(const auto& t : touched){
+        Access& a = access[t.first];
+        if(t.second){
+            a.written = true;
+            a.write = index;
+            a.reads.clear();
+        }
+        else a.reads.push_back(index);
+    }
+
+    nodes.push_back(std::move(node));
+}
+
+// the device copy is made now, so launches recorded later can be bound
+void ecl::Graph::send(Buffer& arg){
+    if(arg.isSegmented() || arg.getMemory() != COPY) throw std::runtime_error("Graph [record]: only plain buffers can be recorded");
+    arg.createBuffer(context);
+
+    add(Node{SEND, &arg, nullptr, {}, {}, {}, {}}, {std::make_pair(&arg, true)});
+}
+void ecl::Graph::receive(Buffer& arg){
+    if(arg.isSegmented() || arg.getMemory() != COPY) throw std::runtime_error("Graph [record]: only plain buffers can be recorded");
+    if(!arg.checkBuffer(context)) throw std::runtime_error("Graph [record]: buffer wasn't sent to computer");
+    if(arg.getAccess() == READ) throw std::runtime_error("Graph [record]: trying to receive read-only data");
+
+    add(Node{RECEIVE, &arg, nullptr, {}, {}, {}, {}}, {std::make_pair(&arg, false)});
+}
+void ecl::Graph::grid(Computer& video, const Frame& frame, const std::vector<std::size_t>& global_work_size, const std::vector<std::size_t>& local_work_size){
+    std::vector<std::pair<const Buffer*, bool>> touched;
+    std::vector<Buffer*> args;
+    for(const auto& a : frame.args){
+        Buffer* buf = const_cast<Buffer*>(a.getBuffer());
+        if(buf == nullptr) continue;
+
+        touched.push_back(std::make_pair(buf, buf->getAccess() != READ));
+        args.push_back(buf);
+    }
+
+    std::unique_ptr<Plan> plan(new Plan(video, frame));
+    add(Node{LAUNCH, nullptr, std::move(plan), global_work_size, local_work_size, {}, args}, touched);
+}
+
+std::size_t ecl::Graph::getSize() const{
+    return nodes.size();
+}
+
+// nodes wait only for the nodes they depend on, the first ones for wait and the previous
+// replay; kernel arguments are set again only for buffers reallocated since. Buffers evicted
+// since are uploaded again before the node using them, which keeps them from eviction meanwhile
+ecl::Event ecl::Graph::run(EXEC sync, const std::vector<Event>& wait){
+    if(context == nullptr) throw std::runtime_error("Graph [run]: nothing was recorded");
+
+    std::vector<Event> roots = wait;
+    roots.push_back(last);
+
+    // host memory holds the latest data of evicted buffers
+    auto restore = [&](Buffer& arg, std::vector<Event>& deps){
+        if(!arg.isEvicted(context) && arg.checkBuffer(context)) return;
+        arg.createBuffer(context);
+        auto wait_list = Event::getWaitList(deps);
+
+        cl_event e;
+        error = clEnqueueWriteBuffer(transfer, arg.getBuffer(context), CL_FALSE, 0, arg.getSize(), arg.getPtr(), wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+        checkError("Graph [run]");
+        deps.push_back(Event(e));
+    };
+
+    std::vector<Event> done(nodes.size());
+    for(std::size_t i = 0; i < nodes.size(); i++){
+        const Node& node = nodes[i];
+
+        std::vector<Event> deps;
+        if(node.deps.empty()) deps = roots;
+        for(auto d : node.deps) deps.push_back(done[d]);
+
+        if(node.kind == LAUNCH){
+            std::size_t pinned = 0;
+            try{
+                for(; pinned < node.args.size(); pinned++){
+                    restore(*node.args[pinned], deps);
+                    Memory::pin(context, node.args[pinned]);
+                }
+
+                if(node.global.empty()) done[i] = node.plan->task(ASYNC, deps);
+                else if(node.local.empty()) done[i] = node.plan->grid(node.global, ASYNC, deps);
+                else done[i] = node.plan->grid(node.global, node.local, ASYNC, deps);
+            }catch(...){
+                for(std::size_t j = 0; j < pinned; j++) Memory::unpin(context, node.args[j]);
+                throw;
+            }
+            for(auto* buf : node.args){
+                Memory::use(context, buf, done[i].getEvent());
+                Memory::unpin(context, buf);
+            }
+            continue;
+        }
+
+        Buffer& arg = *node.buffer;
+        auto wait_list = Event::getWaitList(deps);
+
+        cl_event e;
+        if(node.kind == SEND){
+            arg.createBuffer(context); // evicted or released since
+            error = clEnqueueWriteBuffer(transfer, arg.getBuffer(context), CL_FALSE, 0, arg.getSize(), arg.getPtr(), wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+        }
+        else if(arg.isEvicted(context)) error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e); // host memory got it when it was evicted
+        else{
+            if(!arg.checkBuffer(context)) throw std::runtime_error("Graph [run]: buffer was released");
+            error = clEnqueueReadBuffer(transfer, arg.getBuffer(context), CL_FALSE, 0, arg.getSize(), arg.getPtr(), wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &e);
+        }
+        checkError("Graph [run]");
+
+        done[i] = Event(e);
+        Memory::use(context, &arg, e);
+    }
+
+    auto wait_list = Event::getWaitList(done.empty() ? roots : done);
+
+    cl_event result;
+    error = clEnqueueMarkerWithWaitList(transfer, wait_list.size(), wait_list.empty() ? nullptr : wait_list.data(), &result);
+    checkError("Graph [run]");
+
+    last = Event(result);
+    error = clFlush(queue);
+    if(error == 0 && transfer != queue) error = clFlush(transfer);
+    checkError("Graph [run]");
+
+    if(sync == SYNC) last.await();
+    return last;
+}
+
+void ecl::Graph::clear(){
+    if(recorder != nullptr) recorder->recording = nullptr;
+    recorder = nullptr;
+
+    nodes.clear();
+    access.clear();
+    last.clear();
+
+    if(queue != nullptr) clReleaseCommandQueue(queue);
+    if(transfer != nullptr) clReleaseCommandQueue(transfer);
+
+    context = nullptr;
+    queue = nullptr;
+    transfer = nullptr;
+}
+ecl::Graph::~Graph(){
+    clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Warmup Class Definition
+///////////////////////////////////////////////////////////////////////////////
+ecl::Warmup::Warmup(const std::vector<Frame>& frames, const std::vector<Computer*>& computers){
+    // one build per program and computer, followed by all of its kernels
+    std::vector<std::pair<Program*, std::vector<Kernel*>>> programs;
+    for(const auto& f : frames){
+        auto it = programs.begin();
+        while(it != programs.end() && it->first != &f.prog) it++;
+
+        if(it == programs.end()) programs.emplace_back(&f.prog, std::vector<Kernel*>{&f.kern});
+        else it->second.push_back(&f.kern);
+    }
+
+    // a shared context builds for all of its devices at once
+    std::vector<Computer*> contexts;
+    for(auto* video : computers){
+        auto it = contexts.begin();
+        while(it != contexts.end() && (*it)->getContext() != video->getContext()) it++;
+        if(it == contexts.end()) contexts.push_back(video);
+    }
+
+    errors.resize(programs.size() * contexts.size());
+    threads.reserve(errors.size());
+    try{
+        for(const auto& p : programs){
+            for(auto* video : contexts){
+                std::exception_ptr* result = &errors[threads.size()];
+                threads.emplace_back([p, video, result](){
+                    try{
+                        cl_context context = video->getContext();
+                        p.first->checkProgram(context, video->getDevice());
+
+                        cl_program prog = p.first->getProgram(context);
+                        for(auto* kern : p.second) kern->checkKernel(prog);
+                    }catch(...){
+                        *result = std::current_exception();
+                    }
+                });
+            }
+        }
+    }catch(...){
+        join(); // threads already started still write into errors
+        throw;
+    }
+}
+
+void ecl::Warmup::join(){
+    for(auto& t : threads) if(t.joinable()) t.join();
+}
+
+void ecl::Warmup::await(){
+    join();
+    for(auto& e : errors){
+        if(e){
+            std::exception_ptr first = e;
+            errors.clear();
+            std::rethrow_exception(first);
+        }
+    }
+}
+
+ecl::Warmup::~Warmup(){
+    join();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cluster Class Definition
+///////////////////////////////////////////////////////////////////////////////
+ecl::Cluster::Cluster(const std::vector<Computer*>& computers) : computers(computers), rates(computers.size(), 0.0){
+    if(computers.empty()) throw std::runtime_error("Cluster [init]: no computers");
+}
+
+const std::vector<ecl::Computer*>& ecl::Cluster::getComputers() const{
+    return computers;
+}
+std::vector<double> ecl::Cluster::getRates() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return rates;
+}
+
+// equal until every computer has been measured
+std::vector<double> ecl::Cluster::getShares() const{
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<double> shares(rates.size(), 1.0 / rates.size());
+
+    double total = 0;
+    for(double r : rates){
+        if(r <= 0) return shares;
+        total += r;
+    }
+    for(std::size_t i = 0; i < rates.size(); i++) shares[i] = rates[i] / total;
+
+    return shares;
+}
+
+// one thread per computer, the first error is rethrown after all of them finished
+void ecl::Cluster::parallel(const std::function<void(std::size_t)>& job){
+    std::vector<std::exception_ptr> errors(computers.size());
+    std::vector<std::thread> threads;
+
+    for(std::size_t i = 0; i < computers.size(); i++){
+        threads.emplace_back([&job, &errors, i](){
+            try{
+                job(i);
+            }catch(...){
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for(auto& t : threads) t.join();
+    for(auto& e : errors) if(e) std::rethrow_exception(e);
+}
+
+// every computer gets a full copy of the arguments and claims chunks of the range until it's
+// exhausted, larger ones the faster it was before. Writable arguments are gathered back by
+// slices, so they must hold the same number of bytes for every work-item, indexed by global id
+void ecl::Cluster::grid(const Frame& frame, std::size_t global_work_size, std::size_t granule){
+    if(global_work_size == 0) return;
+    if(granule == 0) granule = 1;
+
+    std::vector<Buffer*> outputs;
+    std::vector<cl_uint> slots; // argument index of every output
+    for(std::size_t k = 0; k < frame.args.size(); k++){
+        Buffer* buf = const_cast<Buffer*>(frame.args[k].getBuffer()); // host data of outputs is written back
+        if(buf == nullptr || buf->getAccess() == READ) continue;
+
+        if(buf->getSize() % global_work_size != 0) throw std::runtime_error("Cluster [grid]: writable argument isn't split by work-items");
+        outputs.push_back(buf);
+        slots.push_back(static_cast<cl_uint>(k));
+    }
+
+    // computers sent here are released afterwards, the caller's own copies stay
+    std::vector<std::vector<Buffer*>> created(computers.size());
+    std::vector<std::vector<std::unique_ptr<Buffer>>> privates(computers.size()); // outputs of computers sharing a context
+    auto cleanup = [&](std::size_t i){
+        for(auto* buf : created[i]) computers[i]->release(*buf);
+        for(auto& buf : privates[i]) computers[i]->release(*buf);
+        privates[i].clear();
+    };
+
+    std::vector<std::size_t> items(computers.size(), 0);
+    std::vector<double> seconds(computers.size(), 0.0);
+
+    // computers of a shared context upload once
+    std::vector<bool> uploads(computers.size(), true);
+    for(std::size_t i = 0; i < computers.size(); i++){
+        for(std::size_t j = 0; j < i; j++) if(computers[j]->getContext() == computers[i]->getContext()) uploads[i] = false;
+    }
+
+    try{
+        // all uploads finish before any slice is written back to the same host memory
+        parallel([&](std::size_t i){
+            if(!uploads[i]) return;
+
+            Computer& video = *computers[i];
+            for(const auto& a : frame.args){
+                Buffer* buf = const_cast<Buffer*>(a.getBuffer());
+                if(buf == nullptr) continue;
+
+                if(!buf->checkBuffer(video.getContext())) created[i].push_back(buf);
+                if(buf->getAccess() == WRITE) buf->createBuffer(video.getContext());
+                else video.send(*buf);
+            }
+        });
+
+        // devices of one context mustn't write the same cl_mem at once, the others write their own copy
+        parallel([&](std::size_t i){
+            if(uploads[i] || outputs.empty()) return;
+
+            Computer& video = *computers[i];
+            for(auto* buf : outputs){
+                privates[i].emplace_back(new Buffer(nullptr, buf->getSize(), READ_WRITE)); // in the budget, never evicted
+                privates[i].back()->createBuffer(video.getContext());
+                cl_mem mem = privates[i].back()->getBuffer(video.getContext());
+
+                if(buf->getAccess() != READ_WRITE) continue;
+                error = clEnqueueCopyBuffer(video.getQueue(), buf->getBuffer(video.getContext()), mem, 0, 0, buf->getSize(), 0, nullptr, nullptr);
+                checkError("Cluster [grid]");
+            }
+            error = clFinish(video.getQueue());
+            checkError("Cluster [grid]");
+        });
+
+        std::vector<double> shares = getShares();
+        std::size_t next = 0;
+        std::mutex claim;
+
+        parallel([&](std::size_t i){
+            Computer& video = *computers[i];
+            auto kern_kernel = video.bindFrame(frame, "Cluster [grid]");
+            for(std::size_t k = 0; k < privates[i].size(); k++){
+                cl_mem mem = privates[i][k]->getBuffer(video.getContext());
+                error = clSetKernelArg(kern_kernel, slots[k], sizeof(cl_mem), &mem);
+                checkError("Cluster [grid]");
+            }
+            // the buffers this computer really uses, its own output copies on a shared context
+            std::vector<Argument> touched = frame.args;
+            for(std::size_t k = 0; k < privates[i].size(); k++) touched[slots[k]] = Argument(privates[i][k].get());
+
+            auto start = std::chrono::steady_clock::now();
+
+            while(true){
+                std::size_t offset, count;
+                {
+                    std::lock_guard<std::mutex> guard(claim);
+                    std::size_t remaining = global_work_size - next;
+                    if(remaining == 0) break;
+
+                    count = static_cast<std::size_t>(remaining * shares[i] / 2);
+                    count = (count + granule - 1) / granule * granule;
+                    count = std::min(std::max(count, granule), remaining);
+
+                    offset = next;
+                    next += count;
+                }
+
+                Event e = video.launch(touched, kern_kernel, {count}, nullptr, ASYNC, {}, "Cluster [grid]", &offset);
+                cl_event ev = e.getEvent();
+
+                for(std::size_t k = 0; k < outputs.size(); k++){
+                    Buffer* buf = outputs[k];
+                    std::size_t item = buf->getSize() / global_work_size;
+                    unsigned char* host = static_cast<unsigned char*>(buf->getPtr());
+                    cl_mem mem = (privates[i].empty() ? buf : privates[i][k].get())->getBuffer(video.getContext());
+
+                    error = clEnqueueReadBuffer(video.getQueue(), mem, CL_TRUE, offset * item, count * item, host + offset * item, 1, &ev, nullptr);
+                    checkError("Cluster [grid]");
+                }
+                if(outputs.empty()) e.await();
+
+                items[i] += count;
+            }
+
+            seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+    catch(...){
+        for(std::size_t i = 0; i < computers.size(); i++) cleanup(i);
+        throw;
+    }
+    for(std::size_t i = 0; i < computers.size(); i++) cleanup(i);
+
+    // gathered outputs are only complete in host memory
+    for(auto* buf : outputs){
+        if(!buf->isCoherent()) continue;
+        buf->markHost(nullptr);
+        buf->invalidate();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    for(std::size_t i = 0; i < computers.size(); i++){
+        if(items[i] == 0 || seconds[i] <= 0) continue;
+
+        double rate = items[i] / seconds[i];
+        rates[i] = rates[i] > 0 ? (rates[i] + rate) / 2 : rate;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+
+TEST_CASE("Buffer Argument") {
+	ecl::array<int> array(5);
+	ecl::Argument arg = &array;
+	CHECK(arg.getBuffer() == &array);
+	CHECK_FALSE(arg.isValue());
+	CHECK_FALSE(arg.isLocal());
+}
+
+TEST_CASE("Value Argument") {
+	ecl::Argument arg = ecl::value(2.5f);
+	CHECK(arg.getBuffer() == nullptr);
+	CHECK(arg.isValue());
+	CHECK_FALSE(arg.isLocal());
+}
+
+TEST_CASE("Local Argument") {
+	ecl::Argument arg = ecl::local<float>(64);
+	CHECK(arg.getBuffer() == nullptr);
+	CHECK_FALSE(arg.isValue());
+	CHECK(arg.isLocal());
+	REQUIRE_THROWS(ecl::local<float>(0));
+}
+
+TEST_CASE("Frame Arguments") {
+	ecl::Program program = "";
+	ecl::Kernel kernel = "";
+	ecl::array<int> array(5);
+	ecl::Frame frame = {program, kernel, {&array, ecl::value(3), ecl::local<int>(16)}};
+	REQUIRE(frame.args.size() == 3);
+	CHECK(frame.args[0].getBuffer() == &array);
+	CHECK(frame.args[1].isValue());
+	CHECK(frame.args[2].isLocal());
+}
\ No newline at end of file
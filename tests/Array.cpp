@@ -1,6 +1,7 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 #include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
 
 TEST_CASE("Default Constructor") {
 	ecl::array<int> array;
@@ -117,4 +118,108 @@ TEST_CASE("Overloaded Operators"){
 	SECTION("Implicit User Defined Conversion") {
 		CHECK(array == A);
 	}
+}
+
+TEST_CASE("Zero Copy") {
+	ecl::array<int> array(5, ecl::ACCESS::READ_WRITE, ecl::MEMORY::ZERO_COPY);
+	REQUIRE(array.getArray() != nullptr);
+	CHECK(array.getMemory() == ecl::MEMORY::ZERO_COPY);
+	CHECK(reinterpret_cast<std::uintptr_t>(array.getArray()) % ecl::HOST_ALIGNMENT == 0);
+
+	ecl::array<int> copy(array);
+	CHECK(copy.getMemory() == ecl::MEMORY::ZERO_COPY);
+	CHECK(reinterpret_cast<std::uintptr_t>(copy.getArray()) % ecl::HOST_ALIGNMENT == 0);
+}
+
+TEST_CASE("Slice") {
+	int A[] = { 0, 1, 2, 3, 4 };
+	ecl::array<int> array(A, 5);
+	ecl::array<int> window = array.slice(1, 3);
+	REQUIRE(window.getArraySize() == 3);
+	CHECK(window.getArray() == A + 1);
+	CHECK(window.getSize() == 3 * sizeof(int));
+	CHECK(window[0] == 1);
+	REQUIRE_THROWS(array.slice(3, 3));
+}
+
+TEST_CASE("Coherence") {
+	ecl::array<int> array(5);
+	CHECK_FALSE(array.isCoherent());
+
+	array.setCoherent(true);
+	CHECK(array.isCoherent());
+	CHECK(array.isHostCurrent());
+	CHECK_FALSE(array.isCurrent(nullptr));
+
+	array[0] = 1;
+	CHECK(array.getConstArray()[0] == 1);
+
+	ecl::array<int> copy(array);
+	CHECK(copy.isCoherent());
+	CHECK(copy[0] == 1);
+}
+
+TEST_CASE("Segments") {
+	ecl::array<double> array(5);
+	CHECK(array.getUnit() == sizeof(double));
+	CHECK_FALSE(array.isSegmented());
+	CHECK(array.getSegments().empty());
+
+	ecl::array<double> copy(array);
+	CHECK(copy.getUnit() == sizeof(double));
+}
+
+TEST_CASE("Adopted Memory") {
+	int* A = new int[5]{ 0, 1, 2, 3, 4 };
+	{
+		ecl::array<int> array(A, 5, ecl::ACCESS::READ_WRITE, ecl::FREE::AUTO);
+		CHECK(array[4] == 4);
+
+		ecl::array<int> moved(std::move(array));
+		CHECK(moved.getArray() == A);
+	}
+
+	const int* B = new int[3]{ 5, 6, 7 };
+	ecl::array<int> adopted(B, 3, ecl::FREE::AUTO);
+	CHECK(adopted.getConstArray() == B);
+	adopted.clear();
+	CHECK(adopted.getArray() == nullptr);
+}
+
+TEST_CASE("Device Slices") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::Program program = "__kernel void f(__global int* a){ size_t i = get_global_id(0); a[i] = -1 - (int)i; }";
+	ecl::Kernel kernel = "f";
+
+	cl_uint bits;
+	REQUIRE(clGetDeviceInfo(video.getDevice(), CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(bits), &bits, nullptr) == CL_SUCCESS);
+	const std::size_t align = bits / 8 / sizeof(int); // elements
+
+	const std::size_t n = 4 * align;
+	ecl::array<int> array(n);
+	for (std::size_t i = 0; i < n; i++) array[i] = int(i);
+	video << array;
+
+	// an origin off CL_DEVICE_MEM_BASE_ADDR_ALIGN is refused
+	if (align > 1) CHECK_THROWS(array.slice(1, align));
+
+	// an aligned one starts at its offset in the device copy
+	ecl::array<int> window = array.slice(align, align);
+	REQUIRE(window.checkBuffer(video.getContext()));
+	video.grid({program, kernel, {&window}}, {align});
+	video.receive(array);
+
+	bool same = true;
+	for (std::size_t i = 0; i < n; i++) {
+		int expected = i >= align && i < 2 * align ? -1 - int(i - align) : int(i);
+		same = same && array.getConstArray()[i] == expected;
+	}
+	CHECK(same);
+
+	video.release(window);
+	video.release(array);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 #include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
 
 TEST_CASE("Constructor") {
 	ecl::Buffer buffer(nullptr, 0, ecl::ACCESS::READ);
@@ -26,4 +27,87 @@ TEST_CASE("Move Assignment Operator") {
 	// TODO
 }
 
+TEST_CASE("Dirty Ranges") {
+	int A[4096] = {};
+	ecl::Buffer buffer(A, sizeof(A), ecl::ACCESS::READ_WRITE);
+	cl_context context = reinterpret_cast<cl_context>(1);
+	std::vector<ecl::Range> ranges;
+
+	REQUIRE_FALSE(buffer.takeDirty(context, ranges));
+	buffer.setTracking(true);
+	REQUIRE_FALSE(buffer.takeDirty(context, ranges)); // first upload is the whole buffer
+
+	buffer.markDirty(100, 4);
+	buffer.markDirty(0, 8);
+	buffer.markDirty(12000, 16);
+	REQUIRE(buffer.takeDirty(context, ranges));
+	REQUIRE(ranges.size() == 2);
+	CHECK(ranges[0] == ecl::Range(0, 104));
+	CHECK(ranges[1] == ecl::Range(12000, 16));
+
+	REQUIRE(buffer.takeDirty(context, ranges));
+	CHECK(ranges.empty());
+	REQUIRE_THROWS(buffer.markDirty(sizeof(A), 1));
+}
+
+TEST_CASE("Dirty Ranges After Read") {
+	int A[256] = {};
+	ecl::Buffer buffer(A, sizeof(A), ecl::ACCESS::READ_WRITE);
+	cl_context source = reinterpret_cast<cl_context>(1);
+	cl_context other = reinterpret_cast<cl_context>(2);
+	std::vector<ecl::Range> ranges;
+
+	buffer.setTracking(true);
+	buffer.takeDirty(source, ranges);
+	buffer.takeDirty(other, ranges);
+
+	// data read from the source device is new to the other one only
+	buffer.markDirty(0, sizeof(A), source);
+	REQUIRE(buffer.takeDirty(source, ranges));
+	CHECK(ranges.empty());
+	REQUIRE(buffer.takeDirty(other, ranges));
+	REQUIRE(ranges.size() == 1);
+	CHECK(ranges[0] == ecl::Range(0, sizeof(A)));
+}
+
+TEST_CASE("Dirty Uploads") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	// computers of a shared context use the same device copy
+	std::vector<ecl::Computer> videos = ecl::Computer::shared(*platform, type);
+	ecl::Computer& first = videos.front();
+	ecl::Computer& last = videos.back();
+
+	std::vector<int> A(4096);
+	for (std::size_t i = 0; i < A.size(); i++) A[i] = int(i);
+	ecl::Buffer buffer(A.data(), A.size() * sizeof(int), ecl::ACCESS::READ_WRITE);
+	buffer.setTracking(true);
+
+	first.send(buffer);
+	CHECK(first.getTraffic().sent == A.size() * sizeof(int));
+
+	// nothing changed, nothing is uploaded
+	last.send(buffer);
+	CHECK(last.getTraffic().sent == 0);
+
+	// only the changed ranges are
+	A[10] = -1;
+	A[3000] = -2;
+	buffer.markDirty(10 * sizeof(int), sizeof(int));
+	buffer.markDirty(3000 * sizeof(int), sizeof(int));
+	last.send(buffer);
+	CHECK(last.getTraffic().sent == 2 * sizeof(int));
+
+	// and the device copy holds them next to the rest
+	std::fill(A.begin(), A.end(), 0);
+	first.receive(buffer);
+	bool same = true;
+	for (std::size_t i = 0; i < A.size(); i++) same = same && A[i] == (i == 10 ? -1 : i == 3000 ? -2 : int(i));
+	CHECK(same);
+
+	first.release(buffer);
+}
+
 // TODO
\ No newline at end of file
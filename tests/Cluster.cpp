@@ -0,0 +1,51 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
+
+TEST_CASE("Empty Cluster") {
+	REQUIRE_THROWS(ecl::Cluster({}));
+}
+
+TEST_CASE("Cluster Gathers Chunks") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	// two computers of one device, each with a context of its own
+	ecl::Computer first(0, *platform, type);
+	ecl::Computer second(0, *platform, type);
+	ecl::Cluster cluster({&first, &second});
+
+	// ids are global, every chunk lands at its offset in the range
+	ecl::Program program = "__kernel void f(__global const int* in, __global int* out){ size_t i = get_global_id(0); out[i] = 2 * in[i] + (int)i; }";
+	ecl::Kernel kernel = "f";
+
+	const std::size_t n = 4096;
+	ecl::array<int> in(n, ecl::ACCESS::READ), out(n, ecl::ACCESS::WRITE);
+	for (std::size_t i = 0; i < n; i++) {
+		in[i] = int(i);
+		out[i] = -1;
+	}
+
+	for (int run = 0; run < 2; run++) {
+		cluster.grid({program, kernel, {&in, &out}}, n, 64);
+
+		bool same = true;
+		for (std::size_t i = 0; i < n; i++) same = same && out[i] == 3 * int(i);
+		CHECK(same);
+	}
+
+	// both computers measured, and the buffers the cluster sent are released again
+	std::vector<double> rates = cluster.getRates();
+	REQUIRE(rates.size() == 2);
+	CHECK((rates[0] > 0 || rates[1] > 0));
+	CHECK_FALSE(in.checkBuffer(first.getContext()));
+	CHECK_FALSE(out.checkBuffer(second.getContext()));
+
+	// an output without a fixed number of bytes per work-item is rejected
+	ecl::array<int> odd(n + 1, ecl::ACCESS::WRITE);
+	CHECK_THROWS(cluster.grid({program, kernel, {&in, &odd}}, n, 64));
+}
+
+// TODO
\ No newline at end of file
@@ -1,9 +1,283 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 #include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
 
 TEST_CASE("Overloaded Constructor 1") {
 	// TODO
 }
 
+TEST_CASE("Tuning Database") {
+	REQUIRE_NOTHROW(ecl::Computer::setTuning("missing/tuning.txt"));
+	REQUIRE_NOTHROW(ecl::Computer::retune());
+
+	std::string corrupt = "easycl_tuning_test.txt";
+	{
+		std::ofstream f(corrupt);
+		f << "dev\t0\tkern\t\t4\tabc\n";
+		f << "dev\t0\tkern\t\t5\t64 x\n";
+		f << "dev\t0\tkern\t\t6\t99999999999999999999999\n";
+		f << "no tabs at all\n";
+	}
+	REQUIRE_NOTHROW(ecl::Computer::setTuning(corrupt));
+	std::remove(corrupt.c_str());
+	ecl::Computer::setTuning("");
+
+	ecl::Program a = "kernel void f(){}";
+	ecl::Program b = "kernel void g(){}";
+	CHECK(a.getHash() != b.getHash());
+	CHECK(a.getHash() == ecl::Program("kernel void f(){}").getHash());
+}
+
+// segments without a device, at a smaller allocation limit
+template<typename T>
+struct Segmented : public ecl::array<T> {
+	Segmented(std::size_t size, std::size_t limit) : ecl::array<T>(size) {
+		ecl::Buffer::split(limit);
+	}
+};
+
+TEST_CASE("Pieces") {
+	ecl::Program program = "";
+	ecl::Kernel kernel = "";
+
+	Segmented<double> big(10, 4 * sizeof(double));
+	REQUIRE(big.getSegments().size() == 3);
+	CHECK(big.getSegments()[2]->getSize() == 2 * sizeof(double));
+
+	ecl::array<float> small(10);
+	ecl::array<int> table(10); // same length, cut without the marker
+	ecl::array<int> lookup(3); // goes whole
+	ecl::Frame frame = {program, kernel, {&big, ecl::piecewise(&small), &table, &lookup, ecl::value(2)}};
+	CHECK(frame.args[1].isPiecewise());
+	CHECK_FALSE(frame.args[2].isPiecewise());
+	CHECK(ecl::Computer::getPiece(frame, {10}) == 4);
+
+	ecl::array<float> shorter(8);
+	ecl::Frame mismatch = {program, kernel, {&big, ecl::piecewise(&shorter)}};
+	CHECK_THROWS(ecl::Computer::getPiece(mismatch, {10}));
+	CHECK_THROWS(ecl::Computer::getPiece(frame, {12}));
+	CHECK_THROWS(ecl::Computer::getPiece(frame, {5, 2}));
+
+	// an explicit local size divides every piece, the last one included
+	CHECK(ecl::Computer::getPiece(frame, {10}, 2) == 4);
+	CHECK_THROWS(ecl::Computer::getPiece(frame, {10}, 4)); // doesn't divide the range
+	CHECK_THROWS(ecl::Computer::getPiece(frame, {10}, 5)); // larger than a segment
+	CHECK_THROWS(ecl::Computer::getPiece(frame, {10}, 0));
+}
+
+TEST_CASE("Copy Validation") {
+	ecl::array<float> a(16), b(8);
+	std::size_t f = sizeof(float);
+
+	CHECK_NOTHROW(ecl::Computer::checkCopy(a, 8 * f, b, 0, 8 * f));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, 9 * f, b, 0, 8 * f));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, 0, b, f, 8 * f));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, SIZE_MAX, b, 0, f)); // offset and size wrap around
+	CHECK_THROWS(ecl::Computer::checkCopy(a, 0, a, 4 * f, 8 * f));
+	CHECK_NOTHROW(ecl::Computer::checkCopy(a, 0, a, 8 * f, 8 * f));
+
+	// clone copies the whole array into one of the same size
+	ecl::array<float> twin(a.getArraySize());
+	CHECK_NOTHROW(ecl::Computer::checkCopy(a, 0, twin, 0, a.getSize()));
+
+	// a as 4 rows of 4 floats, b as 2 rows
+	ecl::Rect whole = {{0, 0}, 4 * f, 0};
+	ecl::Rect corner = {{2 * f, 2}, 4 * f, 0};
+	ecl::Rect packed = {{0, 0}, 0, 0};
+	CHECK_NOTHROW(ecl::Computer::checkCopy(a, corner, b, packed, {2 * f, 2}));
+	CHECK_NOTHROW(ecl::Computer::checkCopy(a, whole, b, whole, {4 * f, 2}));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, corner, b, packed, {2 * f, 3}));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, whole, b, whole, {4 * f, 3}));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, whole, b, whole, {5 * f, 1})); // wider than pitch
+	CHECK_THROWS(ecl::Computer::checkCopy(a, whole, b, whole, {}));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, whole, b, whole, {f, 1, 1, 1}));
+	CHECK_THROWS(ecl::Computer::checkCopy(a, whole, b, whole, {0, 1}));
+
+	float zero = 0;
+	CHECK_NOTHROW(ecl::Computer::checkFill(a, &zero, f, 4 * f, 12 * f));
+	CHECK_THROWS(ecl::Computer::checkFill(a, &zero, f, 8 * f, 12 * f));
+	CHECK_THROWS(ecl::Computer::checkFill(a, &zero, 3, 0, 12));
+	CHECK_THROWS(ecl::Computer::checkFill(a, &zero, 256, 0, 256));
+	CHECK_THROWS(ecl::Computer::checkFill(a, &zero, f, 2, 4 * f));
+	CHECK_THROWS(ecl::Computer::checkFill(a, nullptr, f, 0, 4 * f));
+}
+
+TEST_CASE("Staged Transfers") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type, 1); // tracked, transfers have a queue of their own
+	video.setStaging(64, 2);
+
+	const std::size_t n = 1000; // 4000 bytes in 63 chunks
+	ecl::array<int> array(n);
+	for (std::size_t i = 0; i < n; i++) array[i] = int(i);
+
+	video << array;
+	for (std::size_t i = 0; i < n; i++) array[i] = 0;
+	video >> array;
+
+	bool same = true;
+	for (std::size_t i = 0; i < n; i++) same = same && array[i] == int(i);
+	CHECK(same);
+
+	// counters are updated by completion callbacks, which may run a little after await
+	ecl::Computer::Traffic traffic;
+	for (int i = 0; i < 100; i++) {
+		traffic = video.getTraffic();
+		if (traffic.received == n * sizeof(int)) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	CHECK(traffic.sent == n * sizeof(int));
+	CHECK(traffic.received == n * sizeof(int));
+	CHECK(traffic.staged == 2 * n * sizeof(int));
+
+	video.resetTraffic();
+	CHECK(video.getTraffic().sent == 0);
+	video.release(array);
+}
+
+TEST_CASE("Stream Callbacks") {
+	auto producer = [](float* dst, std::size_t n) -> std::size_t { return dst != nullptr ? n : 0; };
+	auto consumer = [](const int*, std::size_t) {};
+	CHECK((std::is_same<ecl::Callback<decltype(producer)>::type, float>::value));
+	CHECK((std::is_same<ecl::Callback<decltype(consumer)>::type, int>::value));
+
+	// plain lambdas pick the callback overload, which compiles for them
+	void (ecl::Computer::*run)(const ecl::Frame&, decltype(producer), decltype(consumer), std::size_t, std::size_t) = &ecl::Computer::stream;
+	CHECK(run != nullptr);
+
+	// data pointers, const or not, pick the range overload
+	CHECK(ecl::Callable<decltype(producer)>::value);
+	CHECK_FALSE(ecl::Callable<float*>::value);
+	CHECK_FALSE(ecl::Callable<const float*>::value);
+}
+
+TEST_CASE("Stream Pipeline") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type, 2);
+	ecl::Program program = "__kernel void twice(__global const float* in, __global float* out){ size_t i = get_global_id(0); out[i] = 2 * in[i]; }";
+	ecl::Kernel kernel = "twice";
+	ecl::Frame frame = {program, kernel, {}};
+
+	const std::size_t n = 1000, chunk = 256;
+	std::vector<float> in(n), out(n, 0);
+	for (std::size_t i = 0; i < n; i++) in[i] = float(i);
+
+	video.stream(frame, in.data(), out.data(), n, chunk);
+	bool same = true;
+	for (std::size_t i = 0; i < n; i++) same = same && out[i] == 2 * in[i];
+	CHECK(same);
+
+	// the upload of a chunk is ahead of the download of the previous one on the transfer queue,
+	// so once a download is counted the next upload is too
+	const std::size_t chunks = 4, bytes = chunk * sizeof(float);
+	std::size_t produced = 0, consumed = 0;
+	bool ahead = true;
+	video.resetTraffic();
+	video.stream(frame, [&](float* dst, std::size_t size) -> std::size_t {
+		if (produced == chunks) return 0;
+		for (std::size_t i = 0; i < size; i++) dst[i] = float(produced);
+		produced++;
+		return size;
+	}, [&](const float* src, std::size_t size) {
+		consumed++;
+		ecl::Computer::Traffic traffic;
+		for (int i = 0; i < 100; i++) { // counters are updated by completion callbacks
+			traffic = video.getTraffic();
+			if (traffic.received >= consumed * bytes) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if (consumed < chunks) ahead = ahead && traffic.sent >= (consumed + 1) * bytes;
+		same = same && size == chunk && src[0] == 2 * float(consumed - 1);
+	}, chunk);
+	CHECK(consumed == chunks);
+	CHECK(same);
+	CHECK(ahead);
+}
+
+TEST_CASE("Local Sizes") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::Program program = "__kernel void fill(__global int* a, ulong n){ size_t i = get_global_id(0); if(i < n) a[i] = 1; }\n"
+		"__kernel __attribute__((reqd_work_group_size(4, 1, 1))) void fixed(__global int* a){ a[get_global_id(0)] = 2; }";
+	ecl::Kernel fill = "fill";
+	ecl::Kernel fixed = "fixed";
+
+	const std::size_t n = 1000;
+	ecl::array<int> array(n);
+	ecl::Frame frame = {program, fill, {&array}};
+
+	CHECK_THROWS(video.getLocalSize(frame, {}, ecl::FIT));
+	CHECK_THROWS(video.getLocalSize(frame, {1, 1, 1, 1}, ecl::FIT));
+
+	// FIT divides every dimension, odd sizes included
+	for (auto global : std::vector<std::vector<std::size_t>>{{n}, {997}, {64, 30}, {6, 10, 14}}) {
+		std::vector<std::size_t> local = video.getLocalSize(frame, global, ecl::FIT);
+		REQUIRE(local.size() == global.size());
+		for (std::size_t d = 0; d < global.size(); d++) CHECK((local[d] != 0 && global[d] % local[d] == 0));
+	}
+
+	// PAD rounds the range up and passes the real size, work-items past it do nothing
+	std::vector<std::size_t> padded = video.getLocalSize(frame, {n}, ecl::PAD);
+	REQUIRE(padded.size() == 1);
+	CHECK(padded[0] < 2 * n);
+
+	for (std::size_t i = 0; i < n; i++) array[i] = 0;
+	video << array;
+	video.grid(frame, {n}, ecl::PAD);
+	video >> array;
+
+	bool filled = true;
+	for (std::size_t i = 0; i < n; i++) filled = filled && array[i] == 1;
+	CHECK(filled);
+
+	// reqd_work_group_size is taken as is
+	ecl::Frame required = {program, fixed, {&array}};
+	std::vector<std::size_t> local = video.getLocalSize(required, {8}, ecl::FIT);
+	REQUIRE(local.size() == 1);
+	CHECK(local[0] == 4);
+	CHECK_THROWS(video.getLocalSize(required, {10}, ecl::FIT));
+
+	video.release(array);
+}
+
+TEST_CASE("Tuned Local Sizes") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type, 2);
+	ecl::Program program = "__kernel void add(__global int* a){ a[get_global_id(0)] += 1; }";
+	ecl::Kernel kernel = "add";
+
+	const std::size_t n = 1024;
+	ecl::array<int> array(n);
+	for (std::size_t i = 0; i < n; i++) array[i] = 0;
+	video.send(array, ecl::ASYNC); // tuning waits for it, not for the whole computer
+	ecl::Frame frame = {program, kernel, {&array}};
+
+	std::size_t live = video.getMemoryStats().live;
+	std::vector<std::size_t> local = video.getLocalSize(frame, {n}, ecl::TUNE);
+	REQUIRE(local.size() == 1);
+	CHECK(n % local[0] == 0);
+	CHECK(video.getMemoryStats().live == live); // scratch copies are counted and gone again
+
+	// candidates run on the copies, the data is untouched
+	video.receive(array);
+	CHECK(array[0] == 0);
+	CHECK(array[n - 1] == 0);
+
+	ecl::Computer::retune();
+	video.release(array);
+}
+
 // TODO
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+
+// the first device of any type; tests that need one warn and stop without it,
+// so runs on machines without OpenCL devices show what they didn't check
+static bool findDevice(const ecl::Platform*& platform, ecl::DEVICE& type) {
+	try {
+		ecl::System::init();
+		for (const ecl::Platform* p : ecl::System::getPlatformsVector()) {
+			for (ecl::DEVICE t : {ecl::DEVICE::GPU, ecl::DEVICE::CPU, ecl::DEVICE::ACCEL}) {
+				if (p->getDevicesCount(t) == 0) continue;
+				platform = p;
+				type = t;
+				return true;
+			}
+		}
+	}
+	catch (const std::runtime_error&) {
+	}
+	WARN("skipped, no OpenCL device");
+	return false;
+}
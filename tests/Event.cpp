@@ -0,0 +1,24 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+
+TEST_CASE("Default Constructor") {
+	ecl::Event event;
+	REQUIRE(event.getEvent() == nullptr);
+	CHECK(event.getStatus() == CL_COMPLETE);
+	CHECK(event.isComplete());
+	REQUIRE_NOTHROW(event.await());
+}
+
+TEST_CASE("Callback") {
+	ecl::Event event;
+	cl_int status = -1;
+	event.then([&status](cl_int s){ status = s; });
+	CHECK(status == CL_COMPLETE);
+}
+
+TEST_CASE("Wait List") {
+	std::vector<ecl::Event> events(3);
+	CHECK(ecl::Event::getWaitList(events).empty());
+	REQUIRE_NOTHROW(ecl::Event::await(events));
+}
\ No newline at end of file
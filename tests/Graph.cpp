@@ -0,0 +1,42 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
+
+TEST_CASE("Empty Graph") {
+	ecl::Graph graph;
+	CHECK(graph.getSize() == 0);
+	REQUIRE_THROWS(graph.run());
+
+	ecl::Graph moved(std::move(graph));
+	CHECK(moved.getSize() == 0);
+}
+
+TEST_CASE("Recording Graph Goes") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::array<int> array(4);
+	{
+		ecl::Graph graph;
+		video.record(graph);
+		video << array;
+		CHECK(graph.getSize() == 1);
+	}
+	REQUIRE_NOTHROW(video << array); // runs, nothing records it anymore
+
+	ecl::Graph first;
+	video.record(first);
+	ecl::Graph second(std::move(first));
+	video << array;
+	CHECK(second.getSize() == 1);
+	CHECK(first.getSize() == 0);
+
+	video.stop();
+	second.clear();
+	video.release(array);
+}
+
+// TODO
\ No newline at end of file
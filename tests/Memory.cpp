@@ -0,0 +1,132 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
+
+TEST_CASE("Unknown Context") {
+	CHECK(ecl::Memory::getBudget(nullptr) == 0);
+	CHECK(ecl::Memory::getResident(nullptr) == 0);
+}
+
+TEST_CASE("Budget") {
+	REQUIRE_NOTHROW(ecl::Memory::setBudget(nullptr, 1 << 20));
+	CHECK(ecl::Memory::getBudget(nullptr) == 1 << 20);
+
+	ecl::Memory::setBudget(nullptr, 0);
+	CHECK(ecl::Memory::getBudget(nullptr) == 0);
+}
+
+TEST_CASE("Stats") {
+	ecl::Memory::Stats stats = ecl::Memory::getStats(nullptr);
+	CHECK(stats.live == 0);
+	CHECK(stats.buffers == 0);
+	CHECK(stats.peak == 0);
+	CHECK(ecl::Memory::getLargest(nullptr, 10).empty());
+
+	ecl::Memory::setLimit(nullptr, 1 << 20);
+	CHECK(ecl::Memory::getLimit(nullptr) == 1 << 20);
+	ecl::Memory::setLimit(nullptr, 0);
+}
+
+TEST_CASE("Eviction") {
+	int tag;
+	cl_context context = reinterpret_cast<cl_context>(&tag); // never dereferenced, the buffers have no device copies
+
+	ecl::array<int> output(4, ecl::ACCESS::WRITE);
+	ecl::array<int> input(4, ecl::ACCESS::READ);
+	ecl::array<int> coherent(4, ecl::ACCESS::READ_WRITE);
+	coherent.setCoherent(true);
+
+	ecl::Memory::add(context, &output, nullptr);
+	ecl::Memory::add(context, &input, nullptr);
+	ecl::Memory::add(context, &coherent, nullptr);
+	REQUIRE(ecl::Memory::getResident(context) == 3 * 4 * sizeof(int));
+
+	// pinned buffers stay, and the least recently used one is writable without coherence,
+	// nobody knows whether its host or device copy is newer
+	ecl::Memory::pin(context, &input);
+	ecl::Memory::setBudget(context, 4 * sizeof(int));
+	CHECK(ecl::Memory::getResident(context) == 2 * 4 * sizeof(int));
+	CHECK(ecl::Memory::getStats(context).evictions == 1);
+
+	ecl::Memory::unpin(context, &input);
+	ecl::Memory::setBudget(context, 4 * sizeof(int));
+	CHECK(ecl::Memory::getResident(context) == 4 * sizeof(int));
+	CHECK(ecl::Memory::getStats(context).evictions == 2);
+
+	auto largest = ecl::Memory::getLargest(context, 10);
+	REQUIRE(largest.size() == 1);
+	CHECK(largest[0].buffer == &output);
+
+	ecl::Memory::setBudget(context, 0);
+	for (const ecl::Buffer* buf : {static_cast<ecl::Buffer*>(&output), static_cast<ecl::Buffer*>(&input), static_cast<ecl::Buffer*>(&coherent)}) ecl::Memory::drop(context, buf);
+	CHECK(ecl::Memory::getResident(context) == 0);
+}
+
+TEST_CASE("Written Read-Only Buffers") {
+	int tag;
+	cl_context context = reinterpret_cast<cl_context>(&tag);
+
+	// a copy or fill left data in the device copy the host doesn't have
+	ecl::array<int> input(4, ecl::ACCESS::READ);
+	ecl::Memory::add(context, &input, nullptr);
+	ecl::Memory::setWritten(context, &input, true);
+	ecl::Memory::setBudget(context, 1);
+	CHECK(ecl::Memory::getResident(context) == 4 * sizeof(int));
+	CHECK(ecl::Memory::getStats(context).evictions == 0);
+
+	// a whole receive or send makes both copies equal again
+	ecl::Memory::setWritten(context, &input, false);
+	ecl::Memory::setBudget(context, 1);
+	CHECK(ecl::Memory::getResident(context) == 0);
+	CHECK(ecl::Memory::getStats(context).evictions == 1);
+
+	ecl::Memory::setBudget(context, 0);
+	ecl::Memory::forget(context);
+}
+
+TEST_CASE("Forget Context") {
+	int tag;
+	cl_context context = reinterpret_cast<cl_context>(&tag);
+	ecl::array<int> array(4);
+
+	std::size_t live = ecl::Memory::getTotal().live;
+	ecl::Memory::setLimit(context, 1 << 20);
+	ecl::Memory::add(context, &array, nullptr);
+	CHECK(ecl::Memory::getTotal().live == live + 4 * sizeof(int));
+
+	// a new context with the same handle starts over
+	ecl::Memory::forget(context);
+	CHECK(ecl::Memory::getLimit(context) == 0);
+	CHECK(ecl::Memory::getResident(context) == 0);
+	CHECK(ecl::Memory::getTotal().live == live);
+	CHECK(ecl::Memory::getStats(context).reserved == 0);
+}
+
+TEST_CASE("Zero-Copy Accounting") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::array<int> array(1024);
+	array.setMemory(ecl::MEMORY::ZERO_COPY);
+
+	video.send(array);
+	ecl::Memory::Stats stats = video.getMemoryStats();
+	CHECK(stats.live == array.getSize());
+	CHECK(stats.buffers == 1);
+	CHECK(stats.reserved >= array.getSize());
+
+	// the limit holds zero-copy memory too
+	video.setLimit(array.getSize());
+	ecl::array<int> other(1024);
+	other.setMemory(ecl::MEMORY::ZERO_COPY);
+	CHECK_THROWS(video.send(other));
+	video.setLimit(0);
+
+	video.release(array);
+	CHECK(video.getMemoryStats().live == 0);
+}
+
+// TODO
\ No newline at end of file
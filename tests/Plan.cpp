@@ -0,0 +1,115 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
+
+TEST_CASE("Plan Launches") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::Program program = "__kernel void add(__global int* a, int v){ a[get_global_id(0)] += v; }";
+	ecl::Kernel kernel = "add";
+
+	const std::size_t n = 16;
+	ecl::array<int> array(n);
+	for (std::size_t i = 0; i < n; i++) array[i] = 0;
+
+	// buffers aren't uploaded by a plan
+	REQUIRE_THROWS(video.prepare({program, kernel, {&array, ecl::value(1)}}));
+
+	video << array;
+	ecl::Plan plan = video.prepare({program, kernel, {&array, ecl::value(1)}});
+	CHECK(plan.getKernel() != nullptr);
+	plan.grid({n});
+	plan.grid({n});
+	video >> array;
+	CHECK(array[0] == 2);
+	CHECK(array[n - 1] == 2);
+
+	// values are set again through set, and a reallocated buffer is rebound on launch
+	plan.set(1, ecl::value(5));
+	CHECK_THROWS(plan.set(2, ecl::value(5)));
+	video.release(array);
+	video << array;
+	plan.grid({n});
+	video >> array;
+	CHECK(array[0] == 7);
+
+	// moved plans launch, the source is left empty
+	ecl::Plan moved(std::move(plan));
+	CHECK(plan.getKernel() == nullptr);
+	moved.task();
+	video >> array;
+	CHECK(array[0] == 12);
+	CHECK(array[1] == 7);
+
+	video.release(array);
+	CHECK_THROWS(moved.grid({n})); // buffer isn't on the device anymore
+}
+
+TEST_CASE("Plan On Lanes") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type, 2);
+	ecl::Program program = "__kernel void add(__global int* a, int v){ a[get_global_id(0)] += v; }";
+	ecl::Kernel kernel = "add";
+
+	const std::size_t n = 1 << 16;
+	ecl::array<int> array(n);
+	for (std::size_t i = 0; i < n; i++) array[i] = 1;
+
+	// no events passed, the hazard table orders upload, launches and download
+	video.send(array);
+	ecl::Plan plan = video.prepare({program, kernel, {&array, ecl::value(2)}});
+	for (std::size_t i = 0; i < n; i++) array[i] = 10;
+	video.send(array, ecl::ASYNC);
+	plan.grid({n}, ecl::ASYNC);
+	plan.grid({n}, ecl::ASYNC);
+	video.receive(array, ecl::ASYNC);
+	video.await();
+
+	bool same = true;
+	for (std::size_t i = 0; i < n; i++) same = same && array[i] == 14;
+	CHECK(same);
+
+	video.release(array);
+	ecl::Plan empty(std::move(plan));
+	CHECK_THROWS(plan.task());
+}
+
+TEST_CASE("Plan Restores Arguments") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::Program program = "__kernel void add(__global int* a, int v){ a[get_global_id(0)] += v; }";
+	ecl::Kernel kernel = "add";
+
+	const std::size_t n = 16;
+	ecl::array<int> array(n);
+	array.setCoherent(true);
+	for (std::size_t i = 0; i < n; i++) array[i] = 1;
+
+	video << array;
+	ecl::Plan plan = video.prepare({program, kernel, {&array, ecl::value(1)}});
+
+	// evicted arguments come back instead of failing the launch
+	array.evict(video.getContext());
+	REQUIRE(array.isEvicted(video.getContext()));
+	plan.grid({n});
+	CHECK(array.getConstArray()[0] == 2);
+
+	// a newer host copy of a coherent argument is uploaded first
+	for (std::size_t i = 0; i < n; i++) array[i] = 5;
+	plan.grid({n});
+	CHECK(array.getConstArray()[n - 1] == 6);
+
+	video.release(array);
+}
+
+// TODO
\ No newline at end of file
@@ -0,0 +1,117 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
+
+TEST_CASE("Unknown Context") {
+	ecl::Pool::Stats stats = ecl::Pool::getStats(nullptr);
+	CHECK(stats.reserved == 0);
+	CHECK(stats.blocks == 0);
+	REQUIRE_NOTHROW(ecl::Pool::trim(nullptr));
+}
+
+TEST_CASE("Watermarks") {
+	REQUIRE_THROWS(ecl::Pool::setWatermarks(1 << 20, 2 << 20));
+	REQUIRE_NOTHROW(ecl::Pool::setWatermarks(256 << 20, 64 << 20));
+}
+
+TEST_CASE("Blocks Are Reused") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	cl_context context = video.getContext();
+	ecl::Pool::Stats before = ecl::Pool::getStats(context);
+
+	// the first block of a size takes a slab from the driver, the next one is carved from it
+	cl_mem a = ecl::Pool::create(context, ecl::ACCESS::READ_WRITE, 1000);
+	cl_mem b = ecl::Pool::create(context, ecl::ACCESS::READ_WRITE, 1000);
+	ecl::Pool::Stats stats = ecl::Pool::getStats(context);
+	CHECK(stats.misses == before.misses + 1);
+	CHECK(stats.hits == before.hits + 1);
+	CHECK(stats.slabs == before.slabs + 1);
+	CHECK(stats.blocks == before.blocks + 2);
+	CHECK(stats.used == before.used + 2000);
+	CHECK(stats.reserved >= before.reserved + 64 * 1000);
+
+	// released blocks leave the slab idle, but reserved
+	ecl::Pool::release(context, a);
+	ecl::Pool::release(context, b);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.blocks == before.blocks);
+	CHECK(stats.used == before.used);
+	CHECK(stats.idle == stats.reserved - before.reserved + before.idle);
+
+	// and handed out again without the driver
+	cl_mem c = ecl::Pool::create(context, ecl::ACCESS::READ, 500);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.hits == before.hits + 2);
+	CHECK(stats.misses == before.misses + 1);
+	CHECK(stats.slabs == before.slabs + 1);
+	ecl::Pool::release(context, c);
+
+	// zero-copy buffers are allocated on their own
+	cl_mem d = ecl::Pool::create(context, ecl::ACCESS::READ_WRITE, 4096, CL_MEM_ALLOC_HOST_PTR);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.direct == before.direct + 4096);
+	CHECK(stats.slabs == before.slabs + 1);
+	ecl::Pool::release(context, d);
+	CHECK(ecl::Pool::getStats(context).direct == before.direct);
+
+	// trimming gives the idle slab back
+	ecl::Pool::trim(context);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.idle == 0);
+	CHECK(stats.reserved == before.reserved - before.idle);
+}
+
+TEST_CASE("Trim Watermarks") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	cl_context context = video.getContext();
+	ecl::Pool::trim(context);
+
+	// two slabs of different block sizes, both idle after release
+	cl_mem small = ecl::Pool::create(context, ecl::ACCESS::READ_WRITE, 1000);
+	cl_mem large = ecl::Pool::create(context, ecl::ACCESS::READ_WRITE, 100000);
+	ecl::Pool::release(context, small);
+	ecl::Pool::release(context, large);
+
+	ecl::Pool::Stats stats = ecl::Pool::getStats(context);
+	REQUIRE(stats.slabs == 2);
+	REQUIRE(stats.idle == stats.reserved);
+	std::size_t idle = stats.idle;
+
+	// idle memory up to high is kept
+	ecl::Pool::setWatermarks(idle, 0);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.slabs == 2);
+	CHECK(stats.trimmed == 0);
+
+	// above it, slabs are given back until low is left
+	ecl::Pool::setWatermarks(idle - 1, idle - 1);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.slabs == 1);
+	CHECK(stats.trimmed == 1);
+	CHECK(stats.idle <= idle - 1);
+	CHECK(stats.idle == stats.reserved);
+
+	// a release that pushes idle memory over high trims right away
+	ecl::Pool::setWatermarks(0, 0);
+	CHECK(ecl::Pool::getStats(context).slabs == 0);
+	cl_mem again = ecl::Pool::create(context, ecl::ACCESS::READ_WRITE, 1000);
+	ecl::Pool::release(context, again);
+	stats = ecl::Pool::getStats(context);
+	CHECK(stats.slabs == 0);
+	CHECK(stats.idle == 0);
+	CHECK(stats.trimmed == 3);
+
+	ecl::Pool::setWatermarks(256 << 20, 64 << 20);
+	ecl::Pool::trim(context);
+}
+
+// TODO
\ No newline at end of file
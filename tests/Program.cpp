@@ -22,4 +22,32 @@ TEST_CASE("Move Constructor") {
 	// TODO
 }
 
+TEST_CASE("Binary Cache") {
+	REQUIRE(ecl::Program::getCache().empty());
+	ecl::Program::setCache("cache");
+	CHECK(ecl::Program::getCache() == "cache");
+	ecl::Program::setCache("");
+	CHECK(ecl::Program::getCache().empty());
+}
+
+TEST_CASE("Build Options") {
+	ecl::Program program("__kernel void f(){}", "-D TILE=16");
+	CHECK(program.getOptions() == "-D TILE=16");
+	program.setOptions("-cl-fast-relaxed-math");
+	CHECK(program.getOptions() == "-cl-fast-relaxed-math");
+
+	ecl::Program copy = program;
+	CHECK(copy.getOptions() == program.getOptions());
+}
+
+TEST_CASE("Linking Modules") {
+	ecl::Program library("float twice(float x){ return 2 * x; }");
+	ecl::Program program("float twice(float); __kernel void f(__global float* a){ a[0] = twice(a[0]); }");
+	REQUIRE(program.getModules().empty());
+
+	program.link(library);
+	REQUIRE(program.getModules().size() == 1);
+	CHECK(program.getModules()[0] == &library);
+}
+
 // TODO
\ No newline at end of file
@@ -0,0 +1,44 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <EasyCL/EasyCL.hpp>
+#include "Device.hpp"
+
+TEST_CASE("Nothing To Warm") {
+	ecl::Program program = "__kernel void f(){}";
+	ecl::Kernel kernel = "f";
+
+	ecl::Warmup empty({}, {});
+	REQUIRE_NOTHROW(empty.await());
+
+	ecl::Warmup idle({{program, kernel, {}}}, {}); // no computers, no threads
+	REQUIRE_NOTHROW(idle.await());
+
+	ecl::Warmup moved(std::move(idle));
+	REQUIRE_NOTHROW(moved.await());
+}
+
+TEST_CASE("Warm Programs") {
+	const ecl::Platform* platform = nullptr;
+	ecl::DEVICE type = ecl::DEVICE::GPU;
+	if (!findDevice(platform, type)) return;
+
+	ecl::Computer video(0, *platform, type);
+	ecl::Program program = "__kernel void f(){} __kernel void g(){}";
+	ecl::Kernel f = "f";
+	ecl::Kernel g = "g";
+
+	ecl::Warmup warmup({{program, f, {}}, {program, g, {}}}, {&video, &video});
+	REQUIRE_NOTHROW(warmup.await());
+	CHECK(program.checkProgram(video.getContext(), video.getDevice())); // already built
+	CHECK(f.checkKernel(program.getProgram(video.getContext())));
+	CHECK(g.checkKernel(program.getProgram(video.getContext())));
+
+	// build errors surface once, from await
+	ecl::Program broken = "__kernel void h(){ syntax error }";
+	ecl::Kernel h = "h";
+	ecl::Warmup failing({{broken, h, {}}}, {&video});
+	CHECK_THROWS(failing.await());
+	CHECK_NOTHROW(failing.await());
+}
+
+// TODO
\ No newline at end of file